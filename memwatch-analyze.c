@@ -0,0 +1,816 @@
+/*
+** MEMWATCH-ANALYZE.C
+** Offline analyzer for MEMWATCH event traces and log files
+**
+** This file is part of MEMWATCH.
+** MEMWATCH is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version. See gpl.txt for details.
+**
+************************************************************************
+**
+** usage: memwatch-analyze [-j threads] [-n top] [-b buckets] [-c prefix] file
+**
+** 'file' is either a trace written by mwRecordOpen() (see mwtrace.h),
+** or a memwatch log. Traces are read in a single pass: the main thread
+** splits the file into chunks, and worker threads decode and count
+** them into tables of their own, which are added up at the end.
+**
+** For a trace, the report has:
+**
+**  - the global statistics, counted the same way as mwStatReport();
+**      these match the program's own report if tracing was started
+**      before the first allocation
+**  - leaks by site, i.e. allocations that were never freed
+**  - the peak usage timeline, in mwCounter order. Peaks are exact for
+**      single threaded programs; with several threads, events that
+**      interleave within a few thousand counts may be misordered
+**  - lifetimes by site, in mwCounter ticks from allocation to free
+**  - realloc() calls by site: growth, shrinkage and bytes copied
+**  - the top sites by churn (allocations plus frees)
+**
+** A log only has the unfreed blocks, one 'unfreed:' line each or the
+** 'Unfreed:' table of mwUnfreed(), and the global statistics, so only
+** those are reported for it.
+**
+** With -c, the site table is also written to 'prefix-sites.csv' and
+** the timeline to 'prefix-timeline.csv'.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "mwtrace.h"
+
+#define MA_SEGMENT      1024    /* alloc/free events per timeline segment */
+#define MA_QUEUE        8       /* chunks waiting per worker */
+#define MA_AGES         40      /* log2 buckets of block age */
+#define MA_READBUF      (1L<<20)
+#define MA_MAXTHREADS   64
+
+typedef unsigned long long maQWORD;
+
+/* per-site counters, one table per worker */
+typedef struct {
+    maQWORD     allocs, abytes;
+    maQWORD     frees, fbytes;
+    maQWORD     maxsize;
+    maQWORD     agesum, agemax;
+    maQWORD     ages[MA_AGES];
+    maQWORD     reallocs, rgrow, rshrink;
+    maQWORD     rcopied, roldbytes, rnewbytes;
+    } maSite;
+
+/* a run of events from one chunk, for the timeline */
+typedef struct {
+    maQWORD     first, last;    /* counter range */
+    long long   net;            /* bytes allocated minus bytes freed */
+    long long   peak;           /* highest running total within the run */
+    maQWORD     allocs;
+    } maSeg;
+
+typedef struct {
+    maSite*     site;
+    size_t      nsite;
+    maSeg*      seg;
+    size_t      nseg, maxseg;
+    maQWORD     events[8];
+    maQWORD     bad;
+    pthread_t   tid;
+    } maWork;
+
+/* site names, as read from the trace */
+typedef struct {
+    char*       file;
+    long        line;
+    size_t      canon;          /* index in the merged table */
+    } maName;
+
+typedef struct {
+    unsigned char* data;
+    size_t      len;
+    } maJob;
+
+static maName*  maNames = NULL;
+static size_t   maNNames = 0;
+
+static maJob    maQueue[MA_MAXTHREADS*MA_QUEUE];
+static int      maQLen = 0, maQHead = 0, maQSize = 0, maQDone = 0;
+static pthread_mutex_t maQLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t maQPut = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t maQGet = PTHREAD_COND_INITIALIZER;
+
+static FILE*    maIn;
+static unsigned char* maBuf;
+static size_t   maBufLen = 0, maBufPos = 0;
+
+static int      maTop = 10;
+static int      maBuckets = 40;
+static const char* maCsv = NULL;
+
+/***********************************************************************
+** Worker side
+***********************************************************************/
+
+static maSite *maSiteAt( maWork *w, maQWORD id ) {
+    if( id >= w->nsite ) {
+        size_t n = w->nsite ? w->nsite : 256;
+        while( n <= id ) n *= 2;
+        w->site = (maSite*) realloc( w->site, n * sizeof(maSite) );
+        if( w->site == NULL ) { fprintf( stderr, "out of memory\n" ); exit( 2 ); }
+        memset( w->site + w->nsite, 0, ( n - w->nsite ) * sizeof(maSite) );
+        w->nsite = n;
+        }
+    return w->site + id;
+    }
+
+static maSeg *maSegNew( maWork *w, maQWORD counter ) {
+    maSeg *s;
+    if( w->nseg == w->maxseg ) {
+        w->maxseg = w->maxseg ? w->maxseg * 2 : 1024;
+        w->seg = (maSeg*) realloc( w->seg, w->maxseg * sizeof(maSeg) );
+        if( w->seg == NULL ) { fprintf( stderr, "out of memory\n" ); exit( 2 ); }
+        }
+    s = w->seg + w->nseg ++;
+    s->first = s->last = counter;
+    s->net = s->peak = 0;
+    s->allocs = 0;
+    return s;
+    }
+
+static int maLog2( maQWORD v ) {
+    int n = 0;
+    while( v ) { v >>= 1; n ++; }
+    return n < MA_AGES ? n : MA_AGES - 1;
+    }
+
+static void maChunk( maWork *w, const unsigned char *p, const unsigned char *end ) {
+    maQWORD counter = 0, time = 0, site, size, age, oldsize, dv, n = 0;
+    long long addr = 0, dz;
+    maSeg *seg = NULL;
+    maSite *s;
+    int type;
+
+    while( p < end ) {
+        type = *p++;
+        if( !( p = mwtGetVar( p, end, &dv ) ) ) break;
+        counter += dv;
+        if( !( p = mwtGetVar( p, end, &dv ) ) ) break;
+        time += dv;
+        if( !( p = mwtGetVar( p, end, &site ) ) ) break;
+        if( !( p = mwtGetVar( p, end, &size ) ) ) break;
+        if( !( p = mwtGetZig( p, end, &dz ) ) ) break;
+        addr += dz;
+        w->events[type & 7] ++;
+        s = maSiteAt( w, site );
+
+        if( type == MWT_ALLOC || type == MWT_FREE ) {
+            if( seg == NULL || n >= MA_SEGMENT ) { seg = maSegNew( w, counter ); n = 0; }
+            seg->last = counter;
+            n ++;
+            }
+
+        switch( type ) {
+            case MWT_ALLOC:
+                s->allocs ++;
+                s->abytes += size;
+                if( size > s->maxsize ) s->maxsize = size;
+                seg->allocs ++;
+                seg->net += (long long) size;
+                if( seg->net > seg->peak ) seg->peak = seg->net;
+                break;
+            case MWT_FREE:
+                if( !( p = mwtGetVar( p, end, &age ) ) ) break;
+                s->frees ++;
+                s->fbytes += size;
+                s->agesum += age;
+                if( age > s->agemax ) s->agemax = age;
+                s->ages[maLog2( age )] ++;
+                seg->net -= (long long) size;
+                break;
+            case MWT_REALLOC:
+                if( !( p = mwtGetZig( p, end, &dz ) ) ) break;
+                if( !( p = mwtGetVar( p, end, &oldsize ) ) ) break;
+                s->reallocs ++;
+                if( size > oldsize ) s->rgrow ++;
+                if( size < oldsize ) s->rshrink ++;
+                s->rcopied += size < oldsize ? size : oldsize;
+                s->roldbytes += oldsize;
+                s->rnewbytes += size;
+                break;
+            case MWT_MARK:
+            case MWT_UNMARK:
+            case MWT_CHECK:
+                break;
+            default:
+                w->bad ++;
+                return;
+            }
+        if( p == NULL ) break;
+        }
+    if( p != end ) w->bad ++;
+    }
+
+static void *maWorker( void *arg ) {
+    maWork *w = (maWork*) arg;
+    maJob job;
+
+    for(;;) {
+        pthread_mutex_lock( &maQLock );
+        while( maQLen == 0 && !maQDone )
+            pthread_cond_wait( &maQPut, &maQLock );
+        if( maQLen == 0 ) {
+            pthread_mutex_unlock( &maQLock );
+            break;
+            }
+        job = maQueue[maQHead];
+        maQHead = ( maQHead + 1 ) % maQSize;
+        maQLen --;
+        pthread_cond_signal( &maQGet );
+        pthread_mutex_unlock( &maQLock );
+
+        maChunk( w, job.data, job.data + job.len );
+        free( job.data );
+        }
+    return NULL;
+    }
+
+static void maSubmit( unsigned char *data, size_t len ) {
+    pthread_mutex_lock( &maQLock );
+    while( maQLen == maQSize )
+        pthread_cond_wait( &maQGet, &maQLock );
+    maQueue[( maQHead + maQLen ) % maQSize].data = data;
+    maQueue[( maQHead + maQLen ) % maQSize].len = len;
+    maQLen ++;
+    pthread_cond_signal( &maQPut );
+    pthread_mutex_unlock( &maQLock );
+    }
+
+/***********************************************************************
+** Reader side
+***********************************************************************/
+
+static int maGetc( void ) {
+    if( maBufPos == maBufLen ) {
+        maBufLen = fread( maBuf, 1, MA_READBUF, maIn );
+        maBufPos = 0;
+        if( maBufLen == 0 ) return EOF;
+        }
+    return maBuf[maBufPos++];
+    }
+
+static int maRead( unsigned char *to, size_t len ) {
+    size_t n;
+    while( len ) {
+        if( maBufPos == maBufLen ) {
+            maBufLen = fread( maBuf, 1, MA_READBUF, maIn );
+            maBufPos = 0;
+            if( maBufLen == 0 ) return 0;
+            }
+        n = maBufLen - maBufPos;
+        if( n > len ) n = len;
+        memcpy( to, maBuf + maBufPos, n );
+        maBufPos += n;
+        to += n;
+        len -= n;
+        }
+    return 1;
+    }
+
+static int maGetVar( maQWORD *v ) {
+    maQWORD r = 0;
+    int c, shift = 0;
+    while( shift < 64 && ( c = maGetc() ) != EOF ) {
+        r |= (maQWORD)( c & 0x7F ) << shift;
+        if( !( c & 0x80 ) ) { *v = r; return 1; }
+        shift += 7;
+        }
+    return 0;
+    }
+
+static void maSetName( maQWORD id, const char *file, size_t len, maQWORD line ) {
+    if( id >= maNNames ) {
+        size_t n = maNNames ? maNNames : 256;
+        while( n <= id ) n *= 2;
+        maNames = (maName*) realloc( maNames, n * sizeof(maName) );
+        if( maNames == NULL ) { fprintf( stderr, "out of memory\n" ); exit( 2 ); }
+        memset( maNames + maNNames, 0, ( n - maNNames ) * sizeof(maName) );
+        maNNames = n;
+        }
+    free( maNames[id].file );
+    maNames[id].file = (char*) malloc( len + 1 );
+    if( maNames[id].file == NULL ) { fprintf( stderr, "out of memory\n" ); exit( 2 ); }
+    memcpy( maNames[id].file, file, len );
+    maNames[id].file[len] = 0;
+    maNames[id].line = (long) line;
+    }
+
+/* returns zero if the trace is damaged */
+static int maReadTrace( maQWORD *endcounter ) {
+    maQWORD id, line, len, thread;
+    unsigned char *data;
+    int tag;
+
+    while( ( tag = maGetc() ) != EOF ) {
+        switch( tag ) {
+            case MWT_SITE:
+                if( !maGetVar( &id ) || !maGetVar( &line ) || !maGetVar( &len ) ) return 0;
+                data = (unsigned char*) malloc( (size_t) len + 1 );
+                if( data == NULL || !maRead( data, (size_t) len ) ) return 0;
+                maSetName( id, (char*) data, (size_t) len, line );
+                free( data );
+                break;
+            case MWT_CHUNK:
+                if( !maGetVar( &thread ) || !maGetVar( &len ) ) return 0;
+                data = (unsigned char*) malloc( (size_t) len );
+                if( data == NULL || !maRead( data, (size_t) len ) ) return 0;
+                maSubmit( data, (size_t) len );
+                break;
+            case MWT_END:
+                if( !maGetVar( endcounter ) || !maGetVar( &len ) ) return 0;
+                break;
+            default:
+                return 0;
+            }
+        }
+    return 1;
+    }
+
+/***********************************************************************
+** Merging and reporting
+***********************************************************************/
+
+typedef struct {
+    const char* file;
+    long        line;
+    maSite      s;
+    } maRow;
+
+static maRow*   maRows = NULL;
+static size_t   maNRows = 0;
+
+static int maCmpSeg( const void *a, const void *b ) {
+    const maSeg *x = (const maSeg*) a, *y = (const maSeg*) b;
+    return x->first < y->first ? -1 : x->first > y->first;
+    }
+
+static long long maLeak( const maRow *r ) {
+    return (long long) r->s.abytes - (long long) r->s.fbytes;
+    }
+
+static int maCmpLeak( const void *a, const void *b ) {
+    long long x = maLeak( (const maRow*) a ), y = maLeak( (const maRow*) b );
+    return x > y ? -1 : x < y;
+    }
+
+static int maCmpChurn( const void *a, const void *b ) {
+    maQWORD x = ((const maRow*) a)->s.allocs + ((const maRow*) a)->s.frees;
+    maQWORD y = ((const maRow*) b)->s.allocs + ((const maRow*) b)->s.frees;
+    return x > y ? -1 : x < y;
+    }
+
+static int maCmpRealloc( const void *a, const void *b ) {
+    maQWORD x = ((const maRow*) a)->s.rcopied, y = ((const maRow*) b)->s.rcopied;
+    return x > y ? -1 : x < y;
+    }
+
+static int maCmpName( const void *a, const void *b ) {
+    const maName *x = *(const maName**) a, *y = *(const maName**) b;
+    int c = strcmp( x->file, y->file );
+    if( c ) return c;
+    return x->line < y->line ? -1 : x->line > y->line;
+    }
+
+static void maAddSite( maSite *to, const maSite *s ) {
+    int i;
+    to->allocs += s->allocs;
+    to->abytes += s->abytes;
+    to->frees += s->frees;
+    to->fbytes += s->fbytes;
+    if( s->maxsize > to->maxsize ) to->maxsize = s->maxsize;
+    to->agesum += s->agesum;
+    if( s->agemax > to->agemax ) to->agemax = s->agemax;
+    for( i=0; i<MA_AGES; i++ ) to->ages[i] += s->ages[i];
+    to->reallocs += s->reallocs;
+    to->rgrow += s->rgrow;
+    to->rshrink += s->rshrink;
+    to->rcopied += s->rcopied;
+    to->roldbytes += s->roldbytes;
+    to->rnewbytes += s->rnewbytes;
+    }
+
+/*
+** Sites are recorded per file name pointer, so the same file and line
+** can have several ids. They're merged by name here.
+*/
+static void maMerge( maWork *w, int nw ) {
+    maName **order;
+    size_t i, n = 0;
+    int k;
+
+    order = (maName**) malloc( ( maNNames + 1 ) * sizeof(maName*) );
+    maRows = (maRow*) calloc( maNNames + 1, sizeof(maRow) );
+    if( order == NULL || maRows == NULL ) { fprintf( stderr, "out of memory\n" ); exit( 2 ); }
+    for( i=0; i<maNNames; i++ ) {
+        if( maNames[i].file == NULL ) maNames[i].file = strdup( "<unknown>" );
+        order[n++] = maNames + i;
+        }
+    qsort( order, n, sizeof(maName*), maCmpName );
+    for( i=0; i<n; i++ ) {
+        if( maNRows == 0 || maCmpName( &order[i], &order[i-1] ) ) {
+            maRows[maNRows].file = order[i]->file;
+            maRows[maNRows].line = order[i]->line;
+            maNRows ++;
+            }
+        order[i]->canon = maNRows - 1;
+        }
+    free( order );
+
+    for( k=0; k<nw; k++ )
+        for( i=0; i<w[k].nsite; i++ )
+            if( w[k].site[i].allocs || w[k].site[i].frees || w[k].site[i].reallocs ) {
+                if( i < maNNames )
+                    maAddSite( &maRows[maNames[i].canon].s, w[k].site + i );
+                else
+                    maAddSite( &maRows[maNRows].s, w[k].site + i );
+                }
+    }
+
+static const char *maSiteName( const maRow *r, char *buf ) {
+    const char *f = r->file ? r->file : "<unknown>";
+    size_t len = strlen( f );
+    if( len > 36 ) f += len - 36;
+    if( r->line < 0 ) sprintf( buf, "%s", f );
+    else sprintf( buf, "%s(%ld)", f, r->line );
+    return buf;
+    }
+
+/* median age from the log2 histogram, as the lower bound of its bucket */
+static maQWORD maMedian( const maSite *s ) {
+    maQWORD seen = 0;
+    int i;
+    for( i=0; i<MA_AGES; i++ ) {
+        seen += s->ages[i];
+        if( seen * 2 >= s->frees && s->ages[i] ) return i ? (maQWORD) 1 << ( i - 1 ) : 0;
+        }
+    return 0;
+    }
+
+static void maTimeline( maWork *w, int nw, maQWORD *peak, FILE *csv ) {
+    maSeg *all;
+    size_t n = 0, i;
+    long long live = 0, *bpeak, *bend, top = 1;
+    maQWORD *ballocs, first, last = 0, width;
+    char *bset;
+    int k, b, j, bars;
+
+    for( k=0; k<nw; k++ ) n += w[k].nseg;
+    *peak = 0;
+    if( n == 0 ) return;
+    all = (maSeg*) malloc( n * sizeof(maSeg) );
+    bpeak = (long long*) calloc( maBuckets, sizeof(long long) );
+    bend = (long long*) calloc( maBuckets, sizeof(long long) );
+    ballocs = (maQWORD*) calloc( maBuckets, sizeof(maQWORD) );
+    bset = (char*) calloc( maBuckets, 1 );
+    if( !all || !bpeak || !bend || !ballocs || !bset ) { fprintf( stderr, "out of memory\n" ); exit( 2 ); }
+    for( n=0, k=0; k<nw; k++ ) {
+        memcpy( all + n, w[k].seg, w[k].nseg * sizeof(maSeg) );
+        n += w[k].nseg;
+        }
+    qsort( all, n, sizeof(maSeg), maCmpSeg );
+
+    first = all[0].first;
+    for( i=0; i<n; i++ ) if( all[i].last > last ) last = all[i].last;
+    width = ( last - first ) / maBuckets + 1;
+    for( b=0; b<maBuckets; b++ ) bpeak[b] = -1;
+
+    for( i=0; i<n; i++ ) {
+        b = (int)( ( all[i].first - first ) / width );
+        if( live + all[i].peak > bpeak[b] ) bpeak[b] = live + all[i].peak;
+        if( live + all[i].peak > (long long) *peak ) *peak = (maQWORD)( live + all[i].peak );
+        live += all[i].net;
+        ballocs[b] += all[i].allocs;
+        b = (int)( ( all[i].last - first ) / width );
+        bend[b] = live;
+        bset[b] = 1;
+        }
+    for( b=0; b<maBuckets; b++ ) {
+        if( !bset[b] ) bend[b] = b ? bend[b-1] : 0;
+        if( bpeak[b] < 0 ) bpeak[b] = b ? bend[b-1] : 0;
+        if( bpeak[b] < bend[b] ) bpeak[b] = bend[b];
+        if( bpeak[b] > top ) top = bpeak[b];
+        }
+
+    printf( "\nPeak usage timeline (%llu counts per line):\n", (unsigned long long) width );
+    printf( " %-12s %-12s %-12s %-8s\n", "Counter", "Peak", "Live", "Allocs" );
+    for( b=0; b<maBuckets; b++ ) {
+        printf( " %-12llu %-12lld %-12lld %-8llu ", first + (maQWORD) b * width,
+            bpeak[b], bend[b], ballocs[b] );
+        bars = (int)( bpeak[b] * 30 / top );
+        for( j=0; j<bars; j++ ) putchar( '#' );
+        putchar( '\n' );
+        if( csv ) fprintf( csv, "%llu,%lld,%lld,%llu\n", first + (maQWORD) b * width,
+            bpeak[b], bend[b], ballocs[b] );
+        }
+    free( all );
+    free( bpeak );
+    free( bend );
+    free( ballocs );
+    free( bset );
+    }
+
+static void maReport( maWork *w, int nw, maQWORD endcounter ) {
+    maQWORD allocs = 0, abytes = 0, fbytes = 0, peak, leaks = 0, bad = 0, ev[8];
+    FILE *csv = NULL, *tcsv = NULL;
+    char buf[80], path[1024];
+    size_t i, n;
+    int k, j;
+
+    memset( ev, 0, sizeof(ev) );
+    for( k=0; k<nw; k++ ) {
+        for( j=0; j<8; j++ ) ev[j] += w[k].events[j];
+        bad += w[k].bad;
+        }
+    maMerge( w, nw );
+    n = maNRows + 1;
+    for( i=0; i<n; i++ ) {
+        allocs += maRows[i].s.allocs;
+        abytes += maRows[i].s.abytes;
+        fbytes += maRows[i].s.fbytes;
+        if( maRows[i].s.allocs > maRows[i].s.frees )
+            leaks += maRows[i].s.allocs - maRows[i].s.frees;
+        }
+    if( maCsv ) {
+        sprintf( path, "%.1000s-timeline.csv", maCsv );
+        tcsv = fopen( path, "w" );
+        if( tcsv ) fprintf( tcsv, "counter,peak,live,allocs\n" );
+        }
+
+    printf( "Trace: %llu allocs, %llu frees, %llu reallocs, %llu marks, %llu checks",
+        ev[MWT_ALLOC], ev[MWT_FREE], ev[MWT_REALLOC], ev[MWT_MARK], ev[MWT_CHECK] );
+    if( endcounter ) printf( ", ended at <%llu>", endcounter );
+    printf( "\n" );
+    if( bad ) printf( "WARNING: %llu damaged chunks skipped\n", bad );
+
+    maTimeline( w, nw, &peak, tcsv );
+
+    printf( "\nMemory usage statistics (global):\n" );
+    printf( " N)umber of allocations made: %llu\n", allocs );
+    printf( " L)argest memory usage      : %llu\n", peak );
+    printf( " T)otal of all alloc() calls: %llu\n", abytes );
+    printf( " U)nfreed bytes totals      : %llu\n", abytes - fbytes );
+
+    qsort( maRows, n, sizeof(maRow), maCmpLeak );
+    printf( "\nLeaks by site (%llu blocks):\n", leaks );
+    printf( " %-42s %-8s %-10s\n", "Module/Line", "Blocks", "Bytes" );
+    for( i=0; i<n && maLeak( maRows + i ) > 0; i++ )
+        printf( " %-42s %-8lld %-10lld\n", maSiteName( maRows + i, buf ),
+            (long long) maRows[i].s.allocs - (long long) maRows[i].s.frees, maLeak( maRows + i ) );
+
+    qsort( maRows, n, sizeof(maRow), maCmpChurn );
+    printf( "\nTop %d sites by churn:\n", maTop );
+    printf( " %-42s %-8s %-8s %-10s %-8s %-8s\n", "Module/Line", "Allocs", "Frees", "Bytes", "Median", "Max" );
+    for( i=0; i<n && i<(size_t) maTop && maRows[i].s.allocs + maRows[i].s.frees; i++ )
+        printf( " %-42s %-8llu %-8llu %-10llu %-8llu %-8llu\n", maSiteName( maRows + i, buf ),
+            maRows[i].s.allocs, maRows[i].s.frees, maRows[i].s.abytes,
+            maMedian( &maRows[i].s ), maRows[i].s.agemax );
+
+    printf( "\nLifetimes by site (mwCounter ticks from allocation to free):\n" );
+    printf( " %-42s %-8s %-10s %-8s %-8s\n", "Module/Line", "Freed", "Mean", "Median", "Max" );
+    for( i=0; i<n && i<(size_t) maTop; i++ )
+        if( maRows[i].s.frees )
+            printf( " %-42s %-8llu %-10.1f %-8llu %-8llu\n", maSiteName( maRows + i, buf ),
+                maRows[i].s.frees, (double) maRows[i].s.agesum / maRows[i].s.frees,
+                maMedian( &maRows[i].s ), maRows[i].s.agemax );
+
+    qsort( maRows, n, sizeof(maRow), maCmpRealloc );
+    if( n && maRows[0].s.reallocs ) {
+        printf( "\nRealloc by site:\n" );
+        printf( " %-42s %-8s %-8s %-8s %-10s %-6s\n", "Module/Line", "Calls", "Grow", "Shrink", "Copied", "Factor" );
+        for( i=0; i<n && i<(size_t) maTop && maRows[i].s.reallocs; i++ )
+            printf( " %-42s %-8llu %-8llu %-8llu %-10llu %-6.2f\n", maSiteName( maRows + i, buf ),
+                maRows[i].s.reallocs, maRows[i].s.rgrow, maRows[i].s.rshrink, maRows[i].s.rcopied,
+                maRows[i].s.roldbytes ? (double) maRows[i].s.rnewbytes / maRows[i].s.roldbytes : 0.0 );
+        }
+
+    if( maCsv ) {
+        sprintf( path, "%.1000s-sites.csv", maCsv );
+        csv = fopen( path, "w" );
+        if( csv == NULL ) {
+            fprintf( stderr, "can't write '%s'\n", path );
+            }
+        else {
+            fprintf( csv, "file,line,allocs,alloc_bytes,frees,free_bytes,leaked,leaked_bytes,"
+                "max_size,mean_age,median_age,max_age,reallocs,realloc_grow,realloc_shrink,realloc_copied\n" );
+            for( i=0; i<n; i++ ) {
+                const maSite *s = &maRows[i].s;
+                if( !s->allocs && !s->frees && !s->reallocs ) continue;
+                fprintf( csv, "\"%s\",%ld,%llu,%llu,%llu,%llu,%lld,%lld,%llu,%.1f,%llu,%llu,%llu,%llu,%llu,%llu\n",
+                    maRows[i].file ? maRows[i].file : "<unknown>", maRows[i].line,
+                    s->allocs, s->abytes, s->frees, s->fbytes,
+                    (long long) s->allocs - (long long) s->frees, maLeak( maRows + i ),
+                    s->maxsize, s->frees ? (double) s->agesum / s->frees : 0.0,
+                    maMedian( s ), s->agemax, s->reallocs, s->rgrow, s->rshrink, s->rcopied );
+                }
+            fclose( csv );
+            }
+        }
+    if( tcsv ) fclose( tcsv );
+    }
+
+/***********************************************************************
+** Log files
+***********************************************************************/
+
+/* removes the colour escapes mwLogColor() adds */
+static void maStrip( char *s ) {
+    char *o = s;
+    while( *s ) {
+        if( *s == '\033' && s[1] == '[' ) {
+            s += 2;
+            while( *s && *s != 'm' ) s ++;
+            if( *s ) s ++;
+            continue;
+            }
+        *o++ = *s++;
+        }
+    *o = 0;
+    }
+
+/* finds or adds a site row for 'file(line)' */
+static maRow *maRowFor( const char *file, size_t flen, long line, size_t *max ) {
+    size_t i;
+    for( i=0; i<maNRows; i++ )
+        if( maRows[i].line == line && strlen( maRows[i].file ) == flen &&
+            !memcmp( maRows[i].file, file, flen ) ) return maRows + i;
+    if( maNRows == *max ) {
+        *max = *max ? *max * 2 : 256;
+        maRows = (maRow*) realloc( maRows, *max * sizeof(maRow) );
+        if( maRows == NULL ) { fprintf( stderr, "out of memory\n" ); exit( 2 ); }
+        }
+    memset( maRows + maNRows, 0, sizeof(maRow) );
+    maRows[maNRows].file = strndup( file, flen );
+    maRows[maNRows].line = line;
+    return maRows + maNRows ++;
+    }
+
+/*
+** Reads a row of the 'Unfreed:' table mwUnfreedReport() writes:
+**  ' file(line)   bytes   blocks [overflowed]', or '(other sites)'
+** in place of the site. Returns zero for anything else.
+*/
+static int maUnfreedRow( char *line, size_t *max, maQWORD *blocks, maQWORD *bytes ) {
+    char *p, *q, *end;
+    long lineno = -1, n, size;
+    maRow *row;
+
+    end = line + strlen( line );
+    while( end > line && ( end[-1] == '\n' || end[-1] == ' ' ) ) end --;
+    if( end - line > 13 && !memcmp( end - 13, " [overflowed]", 13 ) ) end -= 13;
+    *end = 0;
+    for( p=end; p>line && p[-1]!=' '; p-- ) ;
+    n = atol( p );
+    for( q=p; q>line && q[-1]==' '; q-- ) ;
+    for( p=q; p>line && p[-1]!=' '; p-- ) ;
+    size = atol( p );
+    if( p == line || n <= 0 ) return 0;
+    for( q=p; q>line && q[-1]==' '; q-- ) ;
+    for( p=line; p<q && *p==' '; p++ ) ;
+    if( q == p ) return 0;
+    if( q[-1] == ')' ) {
+        for( end=q-1; end>p && *end!='('; end-- ) ;
+        if( end > p ) {
+            lineno = atol( end + 1 );
+            q = end;
+            }
+        }
+    row = maRowFor( p, (size_t)( q - p ), lineno, max );
+    row->s.allocs += (maQWORD) n;
+    row->s.abytes += (maQWORD) size;
+    *blocks += (maQWORD) n;
+    *bytes += (maQWORD) size;
+    return 1;
+    }
+
+static void maReadLog( void ) {
+    char line[4096], *p, *q, *r, buf[80];
+    size_t max = 0, i;
+    maQWORD blocks = 0, bytes = 0;
+    long lineno, size;
+    maRow *row;
+    int partial = 0, g = 0, table = 0;
+
+    while( fgets( line, sizeof(line), maIn ) ) {
+        int skip = partial;
+        partial = strchr( line, '\n' ) == NULL;
+        if( skip ) continue;
+        maStrip( line );
+        if( line[0] == '\n' ) continue;
+        if( strstr( line, "Memory usage statistics (global)" ) ) { printf( "%s", line ); g = 4; }
+        else if( g > 0 ) { printf( "%s", line ); g --; }
+
+        /* with mwUnfreed(), the unfreed blocks come summed by site */
+        if( !strncmp( line, "Unfreed: ", 9 ) && strstr( line, " bytes in " ) ) {
+            table = 1;
+            continue;
+            }
+        if( table ) {
+            if( line[0] == ' ' && strstr( line, "Module/Line" ) ) continue;
+            if( !strncmp( line, "   at ", 6 ) ) continue;
+            if( line[0] == ' ' && maUnfreedRow( line, &max, &blocks, &bytes ) ) continue;
+            table = 0;
+            }
+
+        /* unfreed: <count> file(line), size bytes at addr ... */
+        if( ( p = strstr( line, "unfreed: <" ) ) == NULL ) continue;
+        if( ( p = strstr( p, "> " ) ) == NULL ) continue;
+        p += 2;
+        if( ( q = strstr( p, " bytes at " ) ) == NULL ) continue;
+        for( r=q; r>p && r[-1]!=' '; r-- ) ;
+        size = atol( r );
+        if( r - p < 4 || r[-2] != ',' || r[-3] != ')' ) continue;
+        q = r - 3;
+        for( r=q; r>p && *r!='('; r-- ) ;
+        if( r == p ) continue;
+        lineno = atol( r + 1 );
+        row = maRowFor( p, (size_t)( r - p ), lineno, &max );
+        row->s.allocs ++;
+        row->s.abytes += (maQWORD) size;
+        blocks ++;
+        bytes += (maQWORD) size;
+        }
+
+    qsort( maRows, maNRows, sizeof(maRow), maCmpLeak );
+    printf( "\nLeaks by site (%llu blocks, %llu bytes):\n", blocks, bytes );
+    printf( " %-42s %-8s %-10s\n", "Module/Line", "Blocks", "Bytes" );
+    for( i=0; i<maNRows; i++ )
+        printf( " %-42s %-8llu %-10llu\n", maSiteName( maRows + i, buf ),
+            maRows[i].s.allocs, maRows[i].s.abytes );
+    }
+
+/***********************************************************************
+** Main
+***********************************************************************/
+
+static void maUsage( void ) {
+    fprintf( stderr, "usage: memwatch-analyze [-j threads] [-n top] [-b buckets] [-c prefix] file\n" );
+    exit( 1 );
+    }
+
+int main( int argc, char **argv ) {
+    maWork w[MA_MAXTHREADS];
+    maQWORD endcounter = 0;
+    char magic[8];
+    int nw, c, ok;
+
+    nw = (int) sysconf( _SC_NPROCESSORS_ONLN );
+    while( ( c = getopt( argc, argv, "j:n:b:c:" ) ) != -1 ) {
+        switch( c ) {
+            case 'j': nw = atoi( optarg ); break;
+            case 'n': maTop = atoi( optarg ); break;
+            case 'b': maBuckets = atoi( optarg ); break;
+            case 'c': maCsv = optarg; break;
+            default: maUsage();
+            }
+        }
+    if( optind != argc - 1 || maTop < 1 || maBuckets < 1 ) maUsage();
+    if( nw < 1 ) nw = 1;
+    if( nw > MA_MAXTHREADS ) nw = MA_MAXTHREADS;
+
+    maIn = fopen( argv[optind], "rb" );
+    if( maIn == NULL ) {
+        perror( argv[optind] );
+        return 1;
+        }
+
+    if( fread( magic, 1, 8, maIn ) != 8 || memcmp( magic, MWT_MAGIC, 8 ) ) {
+        rewind( maIn );
+        maReadLog();
+        fclose( maIn );
+        return 0;
+        }
+
+    maBuf = (unsigned char*) malloc( MA_READBUF );
+    if( maBuf == NULL ) { fprintf( stderr, "out of memory\n" ); return 2; }
+    memset( w, 0, sizeof(w) );
+    maQSize = nw * MA_QUEUE;
+    for( c=0; c<nw; c++ ) pthread_create( &w[c].tid, NULL, maWorker, w + c );
+
+    ok = maReadTrace( &endcounter );
+
+    pthread_mutex_lock( &maQLock );
+    maQDone = 1;
+    pthread_cond_broadcast( &maQPut );
+    pthread_mutex_unlock( &maQLock );
+    for( c=0; c<nw; c++ ) pthread_join( w[c].tid, NULL );
+    fclose( maIn );
+
+    if( !ok ) fprintf( stderr, "%s: trace is truncated or damaged\n", argv[optind] );
+    maReport( w, nw, endcounter );
+    return ok ? 0 : 1;
+    }
+
+/* EOF MEMWATCH-ANALYZE.C */
@@ -0,0 +1,213 @@
+/*
+** MEMWATCH-FLIGHT.C
+** Decoder for the MEMWATCH flight recorder
+**
+** This file is part of MEMWATCH.
+** MEMWATCH is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version. See gpl.txt for details.
+**
+************************************************************************
+**
+** usage: memwatch-flight [-n events] [-t] file
+**
+** 'file' is either the file given to mwFlightOpen(), or a core dump of
+** a program that used the in-memory flight recorder. The recorder is
+** found by searching the file for its header, so it must be read on a
+** machine with the same byte order and word size as the program's.
+**
+** The events of all threads are merged in mwCounter order and the last
+** 'events' of them are listed (all by default). With -t, each thread's
+** events are listed separately instead.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#define MWT_NODECODE
+#include "mwtrace.h"
+
+typedef struct {
+    const mwfEvent* ev;
+    unsigned    thread;
+    } mfItem;
+
+static const mwfHeader* mfHead;
+static const char* mfEnd;
+
+static int mfCmp( const void *a, const void *b ) {
+    const mfItem *x = (const mfItem*) a, *y = (const mfItem*) b;
+    if( x->ev->counter != y->ev->counter ) return x->ev->counter < y->ev->counter ? -1 : 1;
+    return x->thread < y->thread ? -1 : x->thread > y->thread;
+    }
+
+static const char *mfType( unsigned type ) {
+    switch( type ) {
+        case MWT_ALLOC:   return "alloc";
+        case MWT_FREE:    return "free";
+        case MWT_REALLOC: return "realloc";
+        case MWT_MARK:    return "mark";
+        case MWT_UNMARK:  return "unmark";
+        case MWT_CHECK:   return "check";
+        }
+    return "?";
+    }
+
+static const mwfRing *mfRing( MWT_U32 i ) {
+    return (const mwfRing*)( (const char*) mfHead + MWF_RINGS( mfHead->sites, mfHead->pool )
+        + i * MWF_RINGSIZE( mfHead->events ) );
+    }
+
+/* prints file(line) for a site, guarding against a damaged table */
+static void mfSite( MWT_U32 id, char *buf, size_t len ) {
+    const mwfSite *fs = (const mwfSite*)( mfHead + 1 ) + id;
+    const char *pool = (const char*)( (const mwfSite*)( mfHead + 1 ) + mfHead->sites );
+    const char *name = "<unknown>";
+
+    if( id == 0 || id >= mfHead->sites ) {
+        sprintf( buf, "<unknown>" );
+        return;
+        }
+    if( fs->name && fs->name <= mfHead->poolused && memchr( pool + fs->name - 1, 0, mfHead->poolused - fs->name + 1 ) )
+        name = pool + fs->name - 1;
+    if( strlen( name ) + 16 > len ) name += strlen( name ) + 16 - len;
+    sprintf( buf, "%s(%d)", name, (int) fs->line );
+    }
+
+static void mfPrint( const mwfEvent *ev, unsigned thread ) {
+    char site[300];
+
+    mfSite( ev->site, site, sizeof(site) );
+    printf( "<%llu> T%-3u %-8s", (unsigned long long) ev->counter, thread, mfType( ev->type ) );
+    switch( ev->type ) {
+        case MWT_ALLOC:
+            printf( "%llu bytes at 0x%llx, %s\n", (unsigned long long) ev->size,
+                (unsigned long long) ev->addr, site );
+            break;
+        case MWT_FREE:
+            printf( "%llu bytes at 0x%llx, age %llu, alloc'd at %s\n", (unsigned long long) ev->size,
+                (unsigned long long) ev->addr, (unsigned long long) ev->aux, site );
+            break;
+        case MWT_REALLOC:
+            printf( "0x%llx to %llu bytes at 0x%llx, %s\n", (unsigned long long) ev->aux,
+                (unsigned long long) ev->size, (unsigned long long) ev->addr, site );
+            break;
+        case MWT_CHECK:
+            printf( "%llu errors, %s\n", (unsigned long long) ev->size, site );
+            break;
+        default:
+            printf( "0x%llx, %s\n", (unsigned long long) ev->addr, site );
+            break;
+        }
+    }
+
+/* checks that a header is sane and the recorder lies within the file */
+static int mfValid( const mwfHeader *fh, const char *end ) {
+    size_t need;
+    if( memcmp( fh->magic, MWF_MAGIC, 8 ) ) return 0;
+    if( (size_t)( end - (const char*) fh ) < sizeof(mwfHeader) ) return 0;
+    if( fh->rings == 0 || fh->events == 0 || fh->ringsused > fh->rings ) return 0;
+    if( fh->poolused > fh->pool ) return 0;
+    need = MWF_RINGS( fh->sites, fh->pool ) + (size_t) fh->rings * MWF_RINGSIZE( fh->events );
+    return need == fh->size && need <= (size_t)( end - (const char*) fh );
+    }
+
+int main( int argc, char **argv ) {
+    const char *path = NULL;
+    char *data, *p;
+    long size, last = -1;
+    size_t nitems = 0, i, from;
+    int perthread = 0, a;
+    mfItem *items;
+    MWT_U32 r;
+    MWT_U64 e, n;
+    FILE *f;
+
+    for( a=1; a<argc; a++ ) {
+        if( !strcmp( argv[a], "-n" ) && a+1 < argc ) last = atol( argv[++a] );
+        else if( !strcmp( argv[a], "-t" ) ) perthread = 1;
+        else if( argv[a][0] != '-' && path == NULL ) path = argv[a];
+        else path = NULL, a = argc;
+        }
+    if( path == NULL ) {
+        fprintf( stderr, "usage: memwatch-flight [-n events] [-t] file\n" );
+        return 1;
+        }
+
+    f = fopen( path, "rb" );
+    if( f == NULL || fseek( f, 0, SEEK_END ) || ( size = ftell( f ) ) < 0 ) {
+        perror( path );
+        return 1;
+        }
+    rewind( f );
+    data = (char*) malloc( (size_t) size + 1 );
+    if( data == NULL || fread( data, 1, (size_t) size, f ) != (size_t) size ) {
+        fprintf( stderr, "%s: can't read\n", path );
+        return 1;
+        }
+    fclose( f );
+    mfEnd = data + size;
+
+    /* the recorder is 8 byte aligned, both in its file and in memory */
+    mfHead = NULL;
+    for( p=data; p + sizeof(mwfHeader) <= mfEnd; p += 8 ) {
+        if( *p == MWF_MAGIC[0] && mfValid( (const mwfHeader*) p, mfEnd ) ) {
+            mfHead = (const mwfHeader*) p;
+            break;
+            }
+        }
+    if( mfHead == NULL ) {
+        fprintf( stderr, "%s: no flight recorder found\n", path );
+        return 1;
+        }
+
+    printf( "Flight recorder at offset %ld: %u threads, %u events each\n",
+        (long)( (const char*) mfHead - data ), mfHead->ringsused, mfHead->events );
+    printf( "Last counter <%llu>, %u errors detected\n",
+        (unsigned long long) mfHead->counter, mfHead->errors );
+
+    for( n=0, r=0; r<mfHead->ringsused; r++ ) {
+        e = mfRing( r )->head;
+        n += e < mfHead->events ? e : mfHead->events;
+        }
+    items = (mfItem*) malloc( ( n + 1 ) * sizeof(mfItem) );
+    if( items == NULL ) {
+        fprintf( stderr, "out of memory\n" );
+        return 2;
+        }
+
+    for( r=0; r<mfHead->ringsused; r++ ) {
+        const mwfRing *ring = mfRing( r );
+        const mwfEvent *ev = (const mwfEvent*)( ring + 1 );
+        MWT_U64 head = ring->head;
+        e = head > mfHead->events ? head - mfHead->events : 0;
+        if( perthread ) {
+            printf( "\nThread %u, %llu events:\n", ring->thread, (unsigned long long) head );
+            if( last >= 0 && head - e > (MWT_U64) last ) e = head - (MWT_U64) last;
+            }
+        for( ; e<head; e++ ) {
+            if( perthread ) mfPrint( ev + e % mfHead->events, ring->thread );
+            else {
+                items[nitems].ev = ev + e % mfHead->events;
+                items[nitems].thread = ring->thread;
+                nitems ++;
+                }
+            }
+        }
+
+    if( !perthread ) {
+        qsort( items, nitems, sizeof(mfItem), mfCmp );
+        from = last >= 0 && nitems > (size_t) last ? nitems - (size_t) last : 0;
+        printf( "\n" );
+        for( i=from; i<nitems; i++ ) mfPrint( items[i].ev, items[i].thread );
+        }
+
+    free( items );
+    free( data );
+    return 0;
+    }
+
+/* EOF MEMWATCH-FLIGHT.C */
@@ -0,0 +1,395 @@
+/*
+** MEMWATCH-PRELOAD.C
+** Runs programs under MEMWATCH without recompiling them
+**
+** This file is part of MEMWATCH.
+** MEMWATCH is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version. See gpl.txt for details.
+**
+************************************************************************
+**
+** usage: LD_PRELOAD=./libmemwatch.so program [args]
+**
+** 'make preload' builds libmemwatch.so, which replaces malloc(),
+** calloc(), realloc(), free(), the memalign() family,
+** malloc_usable_size() and the C++ operators new and delete, so that
+** every allocation in the program and its libraries goes through
+** memwatch. Memwatch writes to stderr as usual, so a program that
+** closes stderr before it exits loses the report made at exit.
+**
+** There are no file names or line numbers to go by, so a site is
+** named by the module the caller is in, and the line is the offset of
+** the return address in that module; addr2line -e module 0xoffset
+** gives the source line.
+**
+** What memwatch itself allocates, and anything allocated before the
+** library is initialized, comes straight from the C library and is
+** never reported; free() tells the two kinds of block apart with
+** mwOwned(), which looks the block up in memwatch's pointer hash
+** (MW_PTRHASH, always on in this library). Since the C library keeps
+** using some of its blocks after the program is done, unfreed blocks
+** are summed by site at exit and the heap is left as it is; see
+** mwUnfreed().
+**
+** Blocks with a larger alignment than memwatch's own are allocated
+** with room to spare, and the address of the memwatch block is kept
+** just below the aligned pointer. The C++ operators are only replaced
+** on LP64 targets, where their mangled names are known.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include "memwatch.h"
+
+/* we are malloc() and friends */
+#undef malloc
+#undef free
+#undef realloc
+#undef calloc
+#undef strdup
+
+#define MP_CACHE        256     /* (power of 2) call sites cached per thread */
+#define MP_ALIGN        16      /* alignment of memwatch blocks; see the Makefile */
+#define MP_MAGIC        ((size_t) 0x6D77A119UL)
+
+/* initial-exec, so that using these never calls malloc() */
+#define MP_TLS          __thread __attribute__((tls_model("initial-exec")))
+
+extern void *__libc_malloc( size_t );
+extern void *__libc_calloc( size_t, size_t );
+extern void *__libc_realloc( void *, size_t );
+extern void *__libc_memalign( size_t, size_t );
+extern void __libc_free( void * );
+
+/* a return address and the site it's reported as */
+typedef struct {
+    void*       ret;
+    const char* file;
+    int         line;
+    } mpSite;
+
+static volatile int mpState = 0;        /* 0 before init, 1 running, 2 after exit */
+static MP_TLS int mpBusy = 0;           /* in memwatch; use the C library */
+static MP_TLS mpSite mpCache[MP_CACHE];
+static size_t (*mpUsable)( void * ) = NULL;
+
+static void mpStart( void ) __attribute__((constructor));
+static void mpStop( void ) __attribute__((destructor));
+
+static void mpStart( void ) {
+    mpBusy = 1;
+    mwInit();
+    mwUnfreed( MW_UNFREED_TOP, 1 );
+    mpState = 1;
+    mpBusy = 0;
+    }
+
+static void mpStop( void ) {
+    if( mpState != 1 ) return;
+    mpBusy = 1;
+    mpState = 2;
+    mwTerm();
+    mpBusy = 0;
+    }
+
+/* names the caller after its module and offset; call with mpBusy set */
+static void mpSiteOf( void *ret, const char **file, int *line ) {
+    mpSite *c = mpCache + ( ( (size_t) ret >> 2 ) & ( MP_CACHE - 1 ) );
+    Dl_info info;
+
+    if( c->ret != ret || c->file == NULL ) {
+        c->ret = ret;
+        if( dladdr( ret, &info ) && info.dli_fname && *info.dli_fname ) {
+            c->file = info.dli_fname;
+            c->line = (int)( (char*) ret - (char*) info.dli_fbase );
+            }
+        else {
+            c->file = "<unknown>";
+            c->line = (int)(size_t) ret;
+            }
+        }
+    *file = c->file;
+    *line = c->line;
+    }
+
+/*
+** The memwatch block 'p' is or is in, and the bytes from 'p' to its end.
+** Any pointer given to free() has an allocator header below it, so the
+** two words below 'p' can be read; the answer always comes from the
+** pointer hash, never from what they hold.
+*/
+static char *mpBlock( void *p, size_t *size ) {
+    size_t *h = (size_t*) p, raw;
+
+    if( mwOwned( p, size ) ) return (char*) p;
+    if( ( (size_t) p & ( MP_ALIGN - 1 ) ) == 0 ) {
+        raw = h[-1];
+        if( h[-2] == ( MP_MAGIC ^ raw ) && mwOwned( (void*) raw, size ) ) {
+            if( size ) *size -= (size_t)( (char*) p - (char*) raw );
+            return (char*) raw;
+            }
+        }
+    return NULL;
+    }
+
+static void *mpAlloc( size_t size, void *ret ) {
+    const char *file;
+    int line;
+    void *p;
+
+    if( mpState != 1 || mpBusy ) return __libc_malloc( size );
+    mpBusy = 1;
+    mpSiteOf( ret, &file, &line );
+    p = mwMalloc( size, file, line );
+    mpBusy = 0;
+    if( p == NULL ) errno = ENOMEM;
+    return p;
+    }
+
+static void *mpAlign( size_t align, size_t size, void *ret ) {
+    char *raw, *p;
+
+    while( align & ( align - 1 ) ) align += align & -align;
+    if( align <= MP_ALIGN ) return mpAlloc( size, ret );
+    if( mpState != 1 || mpBusy ) return __libc_memalign( align, size );
+    if( size + align + 2 * sizeof(size_t) < size ) {
+        errno = ENOMEM;
+        return NULL;
+        }
+    raw = (char*) mpAlloc( size + align + 2 * sizeof(size_t), ret );
+    if( raw == NULL ) return NULL;
+    p = (char*)( ( (size_t) raw + 2 * sizeof(size_t) + align - 1 ) & ~( align - 1 ) );
+    ((size_t*) p)[-1] = (size_t) raw;
+    ((size_t*) p)[-2] = MP_MAGIC ^ (size_t) raw;
+    return p;
+    }
+
+static void mpFree( void *p, void *ret ) {
+    const char *file;
+    int line;
+    char *raw;
+
+    if( p == NULL ) return;
+    if( mpState == 0 || mpBusy ) {
+        __libc_free( p );
+        return;
+        }
+    mpBusy = 1;
+    raw = mpBlock( p, NULL );
+    if( raw == NULL ) __libc_free( p );
+    else if( mpState == 1 ) {
+        mpSiteOf( ret, &file, &line );
+        mwFree( raw, file, line );
+        }
+    /* after exit, memwatch's blocks are left alone */
+    mpBusy = 0;
+    }
+
+/* the C library's idea of a block's size */
+static size_t mpLibcSize( void *p ) {
+    int busy = mpBusy;
+    if( mpUsable == NULL ) {
+        mpBusy = 1;
+        mpUsable = (size_t(*)(void*)) dlsym( RTLD_NEXT, "malloc_usable_size" );
+        mpBusy = busy;
+        }
+    return mpUsable ? (*mpUsable)( p ) : 0;
+    }
+
+void *malloc( size_t size ) {
+    return mpAlloc( size, __builtin_return_address(0) );
+    }
+
+void free( void *p ) {
+    mpFree( p, __builtin_return_address(0) );
+    }
+
+void *calloc( size_t n, size_t m ) {
+    void *p;
+
+    if( mpState != 1 || mpBusy ) return __libc_calloc( n, m );
+    if( m && n > (size_t) -1 / m ) {
+        errno = ENOMEM;
+        return NULL;
+        }
+    p = mpAlloc( n * m, __builtin_return_address(0) );
+    if( p ) memset( p, 0, n * m );
+    return p;
+    }
+
+void *realloc( void *p, size_t size ) {
+    void *ret = __builtin_return_address(0), *q;
+    const char *file;
+    int line;
+    size_t old;
+    char *raw;
+
+    if( p == NULL ) return mpAlloc( size, ret );
+    if( mpState == 0 || mpBusy ) return __libc_realloc( p, size );
+    mpBusy = 1;
+    raw = mpBlock( p, &old );
+    if( raw == (char*) p && mpState == 1 ) {
+        mpSiteOf( ret, &file, &line );
+        q = mwRealloc( p, size, file, line );
+        mpBusy = 0;
+        if( q == NULL && size ) errno = ENOMEM;
+        return q;
+        }
+    mpBusy = 0;
+    if( raw == NULL && mpState != 1 ) return __libc_realloc( p, size );
+
+    /* an aligned block, or one from before memwatch started; move it */
+    if( raw == NULL ) old = mpLibcSize( p );
+    if( size == 0 ) {
+        mpFree( p, ret );
+        return NULL;
+        }
+    q = mpAlloc( size, ret );
+    if( q == NULL ) return NULL;
+    memcpy( q, p, old < size ? old : size );
+    mpFree( p, ret );
+    return q;
+    }
+
+void *memalign( size_t align, size_t size ) {
+    return mpAlign( align, size, __builtin_return_address(0) );
+    }
+
+void *aligned_alloc( size_t align, size_t size ) {
+    return mpAlign( align, size, __builtin_return_address(0) );
+    }
+
+int posix_memalign( void **pp, size_t align, size_t size ) {
+    void *p;
+
+    if( align < sizeof(void*) || ( align & ( align - 1 ) ) ) return EINVAL;
+    p = mpAlign( align, size, __builtin_return_address(0) );
+    if( p == NULL ) return ENOMEM;
+    *pp = p;
+    return 0;
+    }
+
+void *valloc( size_t size ) {
+    return mpAlign( (size_t) sysconf( _SC_PAGESIZE ), size, __builtin_return_address(0) );
+    }
+
+void *pvalloc( size_t size ) {
+    size_t page = (size_t) sysconf( _SC_PAGESIZE );
+    return mpAlign( page, ( size + page - 1 ) & ~( page - 1 ), __builtin_return_address(0) );
+    }
+
+size_t malloc_usable_size( void *p ) {
+    size_t size;
+    int busy = mpBusy;
+
+    if( p == NULL ) return 0;
+    mpBusy = 1;
+    if( mpBlock( p, &size ) == NULL ) size = mpLibcSize( p );
+    mpBusy = busy;
+    return size;
+    }
+
+/*
+** C++ operators, by their Itanium ABI names. When memwatch fails an
+** allocation, the C++ library's own operator is called instead, so
+** that the new-handler runs and std::bad_alloc is thrown as usual.
+*/
+#if defined(__LP64__) || defined(_LP64)
+
+static void *mpNew( const char *name, size_t size, size_t align, void *ret ) {
+    void *(*next)( size_t, size_t );
+    void *p;
+
+    p = align ? mpAlign( align, size ? size : 1, ret ) : mpAlloc( size ? size : 1, ret );
+    if( p != NULL ) return p;
+    next = (void*(*)(size_t,size_t)) dlsym( RTLD_NEXT, name );
+    if( next == NULL ) abort();
+    return (*next)( size, align );
+    }
+
+void *_Znwm( size_t size ) {
+    return mpNew( "_Znwm", size, 0, __builtin_return_address(0) );
+    }
+
+void *_Znam( size_t size ) {
+    return mpNew( "_Znam", size, 0, __builtin_return_address(0) );
+    }
+
+void *_ZnwmRKSt9nothrow_t( size_t size, const void *nt ) {
+    (void) nt;
+    return mpAlloc( size ? size : 1, __builtin_return_address(0) );
+    }
+
+void *_ZnamRKSt9nothrow_t( size_t size, const void *nt ) {
+    (void) nt;
+    return mpAlloc( size ? size : 1, __builtin_return_address(0) );
+    }
+
+void *_ZnwmSt11align_val_t( size_t size, size_t align ) {
+    return mpNew( "_ZnwmSt11align_val_t", size, align, __builtin_return_address(0) );
+    }
+
+void *_ZnamSt11align_val_t( size_t size, size_t align ) {
+    return mpNew( "_ZnamSt11align_val_t", size, align, __builtin_return_address(0) );
+    }
+
+void _ZdlPv( void *p ) {
+    mpFree( p, __builtin_return_address(0) );
+    }
+
+void _ZdaPv( void *p ) {
+    mpFree( p, __builtin_return_address(0) );
+    }
+
+void _ZdlPvm( void *p, size_t size ) {
+    (void) size;
+    mpFree( p, __builtin_return_address(0) );
+    }
+
+void _ZdaPvm( void *p, size_t size ) {
+    (void) size;
+    mpFree( p, __builtin_return_address(0) );
+    }
+
+void _ZdlPvRKSt9nothrow_t( void *p, const void *nt ) {
+    (void) nt;
+    mpFree( p, __builtin_return_address(0) );
+    }
+
+void _ZdaPvRKSt9nothrow_t( void *p, const void *nt ) {
+    (void) nt;
+    mpFree( p, __builtin_return_address(0) );
+    }
+
+void _ZdlPvSt11align_val_t( void *p, size_t align ) {
+    (void) align;
+    mpFree( p, __builtin_return_address(0) );
+    }
+
+void _ZdaPvSt11align_val_t( void *p, size_t align ) {
+    (void) align;
+    mpFree( p, __builtin_return_address(0) );
+    }
+
+void _ZdlPvmSt11align_val_t( void *p, size_t size, size_t align ) {
+    (void) size;
+    (void) align;
+    mpFree( p, __builtin_return_address(0) );
+    }
+
+void _ZdaPvmSt11align_val_t( void *p, size_t size, size_t align ) {
+    (void) size;
+    (void) align;
+    mpFree( p, __builtin_return_address(0) );
+    }
+
+#endif /* LP64 */
+
+/* EOF MEMWATCH-PRELOAD.C */
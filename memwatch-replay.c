@@ -0,0 +1,627 @@
+/*
+** MEMWATCH-REPLAY.C
+** Replays a MEMWATCH event trace against different allocators
+**
+** This file is part of MEMWATCH.
+** MEMWATCH is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version. See gpl.txt for details.
+**
+************************************************************************
+**
+** usage: memwatch-replay [-t] [-r runs] [-b backend,...] trace
+**
+** The trace written by mwRecordOpen() is turned into a list of malloc,
+** free and realloc operations, which is then run once per backend and
+** run, each time in a fresh child process. For each run, the number of
+** operations per second, the latency percentiles of single operations
+** and the peak RSS growth of the child are reported.
+**
+** Backends:
+**
+**  libc        the C library's malloc(), free() and realloc()
+**  mw          memwatch with its current defaults
+**  mw-stats1   memwatch with mwStatistics(1), per module
+**  mw-stats2   memwatch with mwStatistics(2), per line
+**  mw-nml      memwatch with mwNoMansLand(MW_NML_FREE)
+**  mw-nmlall   memwatch with mwNoMansLand(MW_NML_ALL)
+**  mw-check    memwatch with mwAutoCheck(1); slow on large traces
+**  mw-table    memwatch with mwOutOfLine(1)
+**  so:path     malloc(), free() and realloc() from a shared library
+**
+** The default is "libc,mw". Memwatch's guard zones are compiled in, so
+** every mw backend pays for them. Operations from memwatch backends
+** are attributed to the sites in the trace, so their statistics match
+** the traced program's.
+**
+** Without -t, operations run in the traced order on one thread, which
+** is fully deterministic. With -t, each traced thread is replayed on a
+** thread of its own; an operation on a block another thread allocated
+** waits until that allocation has been replayed.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "mwtrace.h"
+#include "memwatch.h"
+
+/* we call the allocators by name */
+#undef malloc
+#undef free
+#undef realloc
+#undef calloc
+#undef strdup
+
+#define MR_SUB          8       /* latency buckets per power of two */
+#define MR_LAT          (64*MR_SUB)
+#define MR_MAXTHREADS   256
+
+typedef unsigned long long mrQWORD;
+
+/* one recorded event, before pairing */
+typedef struct {
+    mrQWORD     counter;
+    mrQWORD     addr, oldaddr;
+    mrQWORD     size;
+    unsigned    site;
+    unsigned    thread;
+    int         type;
+    } mrEvent;
+
+/* one operation to replay; blocks are numbered from zero */
+typedef struct {
+    int         type;           /* MWT_ALLOC, MWT_FREE or MWT_REALLOC */
+    unsigned    thread;         /* replay thread, from zero */
+    unsigned    site;
+    size_t      size;
+    long        block;          /* the block allocated or freed */
+    long        oldblock;       /* for realloc, the block it replaces */
+    } mrOp;
+
+typedef struct {
+    const char* name;
+    void        (*start)( void );
+    void*       (*alloc)( size_t size, const char *file, int line );
+    void        (*release)( void *p, const char *file, int line );
+    void*       (*resize)( void *p, size_t size, const char *file, int line );
+    void        (*stop)( void );
+    } mrBackend;
+
+typedef struct {
+    double      seconds;
+    long        rss0, rss1;     /* KB at start and peak */
+    mrQWORD     ops, failed;
+    mrQWORD     lat[MR_LAT];
+    } mrResult;
+
+static mrOp*    mrOps = NULL;
+static long     mrNOps = 0;
+static long     mrNBlocks = 0;
+static unsigned mrNThreads = 0;
+static char**   mrSiteName = NULL;
+static long*    mrSiteLine = NULL;
+static size_t   mrNSites = 0;
+
+static void* volatile* mrBlock;     /* replayed address of each block */
+static const mrBackend* mrUse;
+
+/***********************************************************************
+** Backends
+***********************************************************************/
+
+static void *mrLibcAlloc( size_t size, const char *file, int line ) { return malloc( size ); }
+static void mrLibcFree( void *p, const char *file, int line ) { free( p ); }
+static void *mrLibcRealloc( void *p, size_t size, const char *file, int line ) { return realloc( p, size ); }
+
+static void *(*mrSoMalloc)( size_t );
+static void (*mrSoFree)( void* );
+static void *(*mrSoRealloc)( void*, size_t );
+static void *mrSoAlloc( size_t size, const char *file, int line ) { return mrSoMalloc( size ); }
+static void mrSoRelease( void *p, const char *file, int line ) { mrSoFree( p ); }
+static void *mrSoResize( void *p, size_t size, const char *file, int line ) { return mrSoRealloc( p, size ); }
+
+static void mrQuiet( const char *text, unsigned len ) { }
+static void mrMwStart( void ) { mwSetOutSink( mrQuiet ); mwInit(); }
+static void mrMwStats1( void ) { mrMwStart(); mwStatistics( 1 ); }
+static void mrMwStats2( void ) { mrMwStart(); mwStatistics( 2 ); }
+static void mrMwNml( void ) { mrMwStart(); mwNoMansLand( MW_NML_FREE ); }
+static void mrMwNmlAll( void ) { mrMwStart(); mwNoMansLand( MW_NML_ALL ); }
+static void mrMwCheck( void ) { mrMwStart(); mwAutoCheck( 1 ); }
+static void mrMwTable( void ) { mrMwStart(); mwOutOfLine( 1 ); }
+static void mrMwStop( void ) { mwTerm(); }
+
+static const mrBackend mrBackends[] = {
+    { "libc",       NULL,       mrLibcAlloc, mrLibcFree, mrLibcRealloc, NULL },
+    { "mw",         mrMwStart,  mwMalloc, mwFree, mwRealloc, mrMwStop },
+    { "mw-stats1",  mrMwStats1, mwMalloc, mwFree, mwRealloc, mrMwStop },
+    { "mw-stats2",  mrMwStats2, mwMalloc, mwFree, mwRealloc, mrMwStop },
+    { "mw-nml",     mrMwNml,    mwMalloc, mwFree, mwRealloc, mrMwStop },
+    { "mw-nmlall",  mrMwNmlAll, mwMalloc, mwFree, mwRealloc, mrMwStop },
+    { "mw-check",   mrMwCheck,  mwMalloc, mwFree, mwRealloc, mrMwStop },
+    { "mw-table",   mrMwTable,  mwMalloc, mwFree, mwRealloc, mrMwStop },
+    { NULL,         NULL,       NULL, NULL, NULL, NULL }
+    };
+
+static mrBackend mrSo = { NULL, NULL, mrSoAlloc, mrSoRelease, mrSoResize, NULL };
+
+static const mrBackend *mrFind( const char *name ) {
+    void *lib;
+    int i;
+
+    for( i=0; mrBackends[i].name; i++ )
+        if( !strcmp( mrBackends[i].name, name ) ) return mrBackends + i;
+    if( strncmp( name, "so:", 3 ) ) return NULL;
+
+    lib = dlopen( name + 3, RTLD_NOW|RTLD_LOCAL );
+    if( lib == NULL ) {
+        fprintf( stderr, "%s\n", dlerror() );
+        return NULL;
+        }
+    mrSoMalloc = (void*(*)(size_t)) dlsym( lib, "malloc" );
+    mrSoFree = (void(*)(void*)) dlsym( lib, "free" );
+    mrSoRealloc = (void*(*)(void*,size_t)) dlsym( lib, "realloc" );
+    if( !mrSoMalloc || !mrSoFree || !mrSoRealloc ) {
+        fprintf( stderr, "%s: no malloc(), free() or realloc()\n", name + 3 );
+        return NULL;
+        }
+    mrSo.name = name;
+    return &mrSo;
+    }
+
+/***********************************************************************
+** Loading the trace
+***********************************************************************/
+
+static void *mrGrow( void *p, size_t *max, size_t want, size_t each ) {
+    if( want <= *max ) return p;
+    while( *max < want ) *max = *max ? *max * 2 : 1024;
+    p = realloc( p, *max * each );
+    if( p == NULL ) { fprintf( stderr, "out of memory\n" ); exit( 2 ); }
+    return p;
+    }
+
+static int mrCmpEvent( const void *a, const void *b ) {
+    const mrEvent *x = (const mrEvent*) a, *y = (const mrEvent*) b;
+    if( x->counter != y->counter ) return x->counter < y->counter ? -1 : 1;
+    if( x->thread != y->thread ) return x->thread < y->thread ? -1 : 1;
+    return 0;
+    }
+
+/* events of one thread keep their order; qsort isn't stable, so sort on position too */
+typedef struct { mrEvent e; size_t pos; } mrSortEvent;
+
+static int mrCmpSort( const void *a, const void *b ) {
+    int c = mrCmpEvent( a, b );
+    if( c ) return c;
+    return ((const mrSortEvent*) a)->pos < ((const mrSortEvent*) b)->pos ? -1 : 1;
+    }
+
+static mrSortEvent *mrReadTrace( FILE *f, size_t *count ) {
+    mrSortEvent *ev = NULL;
+    size_t n = 0, max = 0, smax = 0, len;
+    unsigned char *buf = NULL, head[8];
+    const unsigned char *p, *end;
+    mrQWORD v, thread, id, line, counter, addr;
+    long long dz;
+    int tag;
+
+    if( fread( head, 1, 8, f ) != 8 || memcmp( head, MWT_MAGIC, 8 ) ) return NULL;
+    while( ( tag = getc( f ) ) != EOF ) {
+        unsigned char var[10];
+        int i, k;
+        mrQWORD vals[3];
+
+        /* up to three varints follow the tag */
+        k = tag == MWT_SITE ? 3 : 2;
+        for( i=0; i<k; i++ ) {
+            int j = 0, c;
+            do {
+                if( ( c = getc( f ) ) == EOF ) return NULL;
+                var[j++] = (unsigned char) c;
+                } while( ( c & 0x80 ) && j < 10 );
+            if( !mwtGetVar( var, var + j, &vals[i] ) ) return NULL;
+            }
+
+        if( tag == MWT_END ) continue;
+        len = (size_t)( tag == MWT_SITE ? vals[2] : vals[1] );
+        buf = (unsigned char*) realloc( buf, len + 1 );
+        if( buf == NULL || fread( buf, 1, len, f ) != len ) return NULL;
+
+        if( tag == MWT_SITE ) {
+            id = vals[0];
+            line = vals[1];
+            mrSiteName = (char**) mrGrow( mrSiteName, &smax, (size_t) id + 1, sizeof(char*) );
+            mrSiteLine = (long*) realloc( mrSiteLine, smax * sizeof(long) );
+            if( mrSiteLine == NULL ) { fprintf( stderr, "out of memory\n" ); exit( 2 ); }
+            while( mrNSites < smax ) { mrSiteName[mrNSites] = NULL; mrSiteLine[mrNSites++] = 0; }
+            buf[len] = 0;
+            mrSiteName[id] = strdup( (char*) buf );
+            mrSiteLine[id] = (long) line;
+            continue;
+            }
+        if( tag != MWT_CHUNK ) return NULL;
+
+        thread = vals[0];
+        counter = 0;
+        addr = 0;
+        p = buf;
+        end = buf + len;
+        while( p < end ) {
+            mrEvent *e;
+            int type = *p++;
+            ev = (mrSortEvent*) mrGrow( ev, &max, n + 1, sizeof(mrSortEvent) );
+            e = &ev[n].e;
+            ev[n].pos = n;
+            if( !( p = mwtGetVar( p, end, &v ) ) ) return NULL;
+            counter += v;
+            if( !( p = mwtGetVar( p, end, &v ) ) ) return NULL;
+            if( !( p = mwtGetVar( p, end, &v ) ) ) return NULL;
+            e->site = (unsigned) v;
+            if( !( p = mwtGetVar( p, end, &e->size ) ) ) return NULL;
+            if( !( p = mwtGetZig( p, end, &dz ) ) ) return NULL;
+            addr += dz;
+            e->counter = counter;
+            e->addr = addr;
+            e->thread = (unsigned) thread;
+            e->type = type;
+            if( type == MWT_FREE && !( p = mwtGetVar( p, end, &v ) ) ) return NULL;
+            if( type == MWT_REALLOC ) {
+                if( !( p = mwtGetZig( p, end, &dz ) ) ) return NULL;
+                e->oldaddr = addr + dz;
+                if( !( p = mwtGetVar( p, end, &v ) ) ) return NULL;
+                }
+            if( type == MWT_ALLOC || type == MWT_FREE || type == MWT_REALLOC ) n ++;
+            }
+        }
+    free( buf );
+    *count = n;
+    return ev;
+    }
+
+/* address to block number, for the blocks alive at a point in the trace */
+typedef struct { mrQWORD addr; long block; } mrLive;
+static mrLive*  mrLiveTab;
+static size_t   mrLiveSize;
+
+static size_t mrLiveSlot( mrQWORD addr ) {
+    size_t i = (size_t)( ( addr >> 3 ) * 0x9E3779B97F4A7C15ULL ) & ( mrLiveSize - 1 );
+    while( mrLiveTab[i].block >= 0 && mrLiveTab[i].addr != addr ) i = ( i + 1 ) & ( mrLiveSize - 1 );
+    return i;
+    }
+
+static long mrLiveTake( mrQWORD addr ) {
+    size_t i = mrLiveSlot( addr ), j, k;
+    long b = mrLiveTab[i].block;
+    if( b < 0 ) return -1;
+    /* backward shift deletion */
+    mrLiveTab[i].block = -1;
+    for( j = ( i + 1 ) & ( mrLiveSize - 1 ); mrLiveTab[j].block >= 0; j = ( j + 1 ) & ( mrLiveSize - 1 ) ) {
+        k = (size_t)( ( mrLiveTab[j].addr >> 3 ) * 0x9E3779B97F4A7C15ULL ) & ( mrLiveSize - 1 );
+        if( ( j > i && ( k <= i || k > j ) ) || ( j < i && ( k <= i && k > j ) ) ) {
+            mrLiveTab[i] = mrLiveTab[j];
+            mrLiveTab[j].block = -1;
+            i = j;
+            }
+        }
+    return b;
+    }
+
+/*
+** memwatch's realloc() is an alloc, a free and a realloc event, in that
+** order, so the last two operations are folded into one realloc.
+*/
+static void mrPair( mrSortEvent *ev, size_t n ) {
+    unsigned tids[MR_MAXTHREADS];
+    size_t i, j, maxops = 0;
+    mrOp *op;
+
+    mrLiveSize = 1024;
+    while( mrLiveSize < n ) mrLiveSize *= 2;
+    mrLiveTab = (mrLive*) malloc( mrLiveSize * sizeof(mrLive) );
+    if( mrLiveTab == NULL ) { fprintf( stderr, "out of memory\n" ); exit( 2 ); }
+    for( i=0; i<mrLiveSize; i++ ) mrLiveTab[i].block = -1;
+
+    for( i=0; i<n; i++ ) {
+        mrEvent *e = &ev[i].e;
+
+        /* threads past the last replay thread share it */
+        for( j=0; j<mrNThreads && tids[j]!=e->thread; j++ ) ;
+        if( j == mrNThreads ) {
+            if( mrNThreads == MR_MAXTHREADS ) j = MR_MAXTHREADS - 1;
+            else tids[mrNThreads++] = e->thread;
+            }
+
+        if( e->type == MWT_REALLOC ) {
+            if( mrNOps >= 2 && mrOps[mrNOps-2].type == MWT_ALLOC && mrOps[mrNOps-1].type == MWT_FREE ) {
+                mrOps[mrNOps-2].type = MWT_REALLOC;
+                mrOps[mrNOps-2].oldblock = mrOps[mrNOps-1].block;
+                mrNOps --;
+                }
+            continue;
+            }
+
+        mrOps = (mrOp*) mrGrow( mrOps, &maxops, (size_t) mrNOps + 1, sizeof(mrOp) );
+        op = mrOps + mrNOps;
+        op->type = e->type;
+        op->thread = (unsigned) j;
+        op->site = e->site;
+        op->size = (size_t) e->size;
+        op->oldblock = -1;
+        if( e->type == MWT_ALLOC ) {
+            size_t s = mrLiveSlot( e->addr );
+            mrLiveTab[s].addr = e->addr;
+            mrLiveTab[s].block = op->block = mrNBlocks ++;
+            mrNOps ++;
+            }
+        else if( ( op->block = mrLiveTake( e->addr ) ) >= 0 ) {
+            mrNOps ++;
+            }
+        }
+    free( mrLiveTab );
+    }
+
+/***********************************************************************
+** Replaying
+***********************************************************************/
+
+static mrQWORD mrNow( void ) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (mrQWORD) ts.tv_sec * 1000000000ULL + (mrQWORD) ts.tv_nsec;
+    }
+
+/* log-linear bucket for a latency in nanoseconds */
+static int mrLatBucket( mrQWORD ns ) {
+    int e = 0;
+    if( ns < MR_SUB ) return (int) ns;
+    while( ( ns >> e ) >= 2 * MR_SUB ) e ++;
+    return ( e + 1 ) * MR_SUB + (int)( ( ns >> e ) - MR_SUB );
+    }
+
+static mrQWORD mrLatValue( int b ) {
+    int e = b / MR_SUB - 1;
+    if( b < MR_SUB ) return (mrQWORD) b;
+    return (mrQWORD)( MR_SUB + b % MR_SUB ) << e;
+    }
+
+static const char *mrName( unsigned site ) {
+    return site < mrNSites && mrSiteName[site] ? mrSiteName[site] : "replay";
+    }
+
+static int mrLine( unsigned site ) {
+    return site < mrNSites ? (int) mrSiteLine[site] : 0;
+    }
+
+static void mrRun( mrResult *r, unsigned thread, int threaded ) {
+    const mrBackend *b = mrUse;
+    mrQWORD t0, t1;
+    mrOp *op;
+    long i;
+    void *p;
+
+    for( i=0; i<mrNOps; i++ ) {
+        op = mrOps + i;
+        if( threaded ) {
+            if( op->thread != thread ) continue;
+            /* wait for the block to exist if another thread allocates it */
+            if( op->type == MWT_FREE )
+                while( mrBlock[op->block] == NULL ) sched_yield();
+            if( op->type == MWT_REALLOC )
+                while( mrBlock[op->oldblock] == NULL ) sched_yield();
+            }
+        t0 = mrNow();
+        switch( op->type ) {
+            case MWT_ALLOC:
+                p = b->alloc( op->size ? op->size : 1, mrName( op->site ), mrLine( op->site ) );
+                if( p == NULL ) { r->failed ++; p = (void*) 1; }
+                mrBlock[op->block] = p;
+                break;
+            case MWT_FREE:
+                p = mrBlock[op->block];
+                if( p != (void*) 1 ) b->release( p, mrName( op->site ), mrLine( op->site ) );
+                break;
+            case MWT_REALLOC:
+                p = mrBlock[op->oldblock];
+                if( p != (void*) 1 ) p = b->resize( p, op->size ? op->size : 1,
+                    mrName( op->site ), mrLine( op->site ) );
+                if( p == NULL ) { r->failed ++; p = (void*) 1; }
+                mrBlock[op->block] = p;
+                break;
+            }
+        t1 = mrNow();
+        r->lat[mrLatBucket( t1 - t0 )] ++;
+        r->ops ++;
+        }
+    }
+
+typedef struct { mrResult r; unsigned thread; pthread_t tid; } mrThread;
+
+static void *mrThreadMain( void *arg ) {
+    mrThread *t = (mrThread*) arg;
+    mrRun( &t->r, t->thread, 1 );
+    return NULL;
+    }
+
+/*
+** Resident set size in KB; 'peak' gives the high water mark. On Linux
+** the mark is reset at the start of a run, as the child inherits the
+** parent's. Elsewhere getrusage() is all there is.
+*/
+static long mrRss( int peak ) {
+    struct rusage ru;
+    char line[128];
+    long kb = -1;
+    FILE *f;
+
+    f = fopen( "/proc/self/status", "r" );
+    if( f != NULL ) {
+        while( fgets( line, sizeof(line), f ) )
+            if( !strncmp( line, peak ? "VmHWM:" : "VmRSS:", 6 ) ) kb = atol( line + 6 );
+        fclose( f );
+        }
+    if( kb >= 0 ) return kb;
+    getrusage( RUSAGE_SELF, &ru );
+    return ru.ru_maxrss;
+    }
+
+static void mrRssReset( void ) {
+    FILE *f = fopen( "/proc/self/clear_refs", "w" );
+    if( f == NULL ) return;
+    fputs( "5", f );
+    fclose( f );
+    }
+
+/* runs in a child process, so every run starts with a clean heap */
+static void mrChild( int fd, int threaded ) {
+    mrResult *r;
+    mrThread *t;
+    mrQWORD t0;
+    unsigned i;
+    int k;
+
+    r = (mrResult*) calloc( 1, sizeof(mrResult) );
+    mrBlock = (void* volatile*) calloc( (size_t) mrNBlocks + 1, sizeof(void*) );
+    if( r == NULL || mrBlock == NULL ) _exit( 2 );
+
+    /* the backend's own output isn't wanted */
+    k = open( "/dev/null", O_WRONLY );
+    if( k >= 0 ) {
+        dup2( k, 1 );
+        dup2( k, 2 );
+        close( k );
+        }
+    if( mrUse->start ) mrUse->start();
+    mrRssReset();
+    r->rss0 = mrRss( 0 );
+
+    t0 = mrNow();
+    if( !threaded || mrNThreads < 2 ) mrRun( r, 0, 0 );
+    else {
+        t = (mrThread*) calloc( mrNThreads, sizeof(mrThread) );
+        if( t == NULL ) _exit( 2 );
+        for( i=0; i<mrNThreads; i++ ) {
+            t[i].thread = i;
+            pthread_create( &t[i].tid, NULL, mrThreadMain, t + i );
+            }
+        for( i=0; i<mrNThreads; i++ ) {
+            pthread_join( t[i].tid, NULL );
+            r->ops += t[i].r.ops;
+            r->failed += t[i].r.failed;
+            for( k=0; k<MR_LAT; k++ ) r->lat[k] += t[i].r.lat[k];
+            }
+        }
+    r->seconds = (double)( mrNow() - t0 ) / 1e9;
+    r->rss1 = mrRss( 1 );
+    if( mrUse->stop ) mrUse->stop();
+
+    if( write( fd, r, sizeof(mrResult) ) != (ssize_t) sizeof(mrResult) ) _exit( 2 );
+    _exit( 0 );
+    }
+
+static mrQWORD mrPercentile( const mrResult *r, double pct ) {
+    mrQWORD want = (mrQWORD)( r->ops * pct / 100.0 ), seen = 0;
+    int b;
+    for( b=0; b<MR_LAT; b++ ) {
+        seen += r->lat[b];
+        if( seen > want ) return mrLatValue( b );
+        }
+    return mrLatValue( MR_LAT - 1 );
+    }
+
+static int mrReplay( const char *name, int threaded ) {
+    mrResult r;
+    int fds[2], status, b;
+    size_t got = 0;
+    ssize_t n;
+    pid_t pid;
+
+    if( pipe( fds ) ) { perror( "pipe" ); return 0; }
+    fflush( stdout );
+    pid = fork();
+    if( pid < 0 ) { perror( "fork" ); return 0; }
+    if( pid == 0 ) {
+        close( fds[0] );
+        mrChild( fds[1], threaded );
+        }
+    close( fds[1] );
+    while( got < sizeof(r) && ( n = read( fds[0], (char*) &r + got, sizeof(r) - got ) ) > 0 )
+        got += (size_t) n;
+    close( fds[0] );
+    waitpid( pid, &status, 0 );
+    if( got != sizeof(r) ) {
+        printf( " %-14s failed (status %d)\n", name, status );
+        return 0;
+        }
+
+    for( b=MR_LAT-1; b>0 && !r.lat[b]; b-- ) ;
+    printf( " %-14s %-11.0f %-7llu %-7llu %-7llu %-7llu %-9llu %-9ld",
+        name, r.seconds > 0 ? r.ops / r.seconds : 0.0,
+        mrPercentile( &r, 50 ), mrPercentile( &r, 90 ), mrPercentile( &r, 99 ),
+        mrPercentile( &r, 99.9 ), mrLatValue( b ), r.rss1 - r.rss0 );
+    if( r.failed ) printf( " %llu failed", r.failed );
+    printf( "\n" );
+    return 1;
+    }
+
+int main( int argc, char **argv ) {
+    const char *list = "libc,mw";
+    char *names, *name, *save;
+    int threaded = 0, runs = 1, a, i;
+    mrSortEvent *ev;
+    size_t n;
+    FILE *f;
+
+    for( a=1; a<argc-1; a++ ) {
+        if( !strcmp( argv[a], "-t" ) ) threaded = 1;
+        else if( !strcmp( argv[a], "-r" ) ) runs = atoi( argv[++a] );
+        else if( !strcmp( argv[a], "-b" ) ) list = argv[++a];
+        else break;
+        }
+    if( a != argc - 1 || runs < 1 ) {
+        fprintf( stderr, "usage: memwatch-replay [-t] [-r runs] [-b backend,...] trace\n" );
+        return 1;
+        }
+
+    f = fopen( argv[a], "rb" );
+    if( f == NULL ) { perror( argv[a] ); return 1; }
+    ev = mrReadTrace( f, &n );
+    fclose( f );
+    if( ev == NULL ) {
+        fprintf( stderr, "%s: not a memwatch trace, or damaged\n", argv[a] );
+        return 1;
+        }
+    qsort( ev, n, sizeof(mrSortEvent), mrCmpSort );
+    mrPair( ev, n );
+    free( ev );
+
+    printf( "Replaying %ld operations on %ld blocks from %u thread%s%s\n",
+        mrNOps, mrNBlocks, mrNThreads, mrNThreads == 1 ? "" : "s",
+        threaded ? ", threaded" : "" );
+    printf( " %-14s %-11s %-7s %-7s %-7s %-7s %-9s %-9s\n", "Backend", "Ops/s",
+        "p50", "p90", "p99", "p99.9", "max(ns)", "RSS(KB)" );
+
+    names = strdup( list );
+    for( name = strtok_r( names, ",", &save ); name; name = strtok_r( NULL, ",", &save ) ) {
+        mrUse = mrFind( name );
+        if( mrUse == NULL ) {
+            fprintf( stderr, "unknown backend '%s'\n", name );
+            continue;
+            }
+        for( i=0; i<runs; i++ ) mrReplay( name, threaded );
+        }
+    free( names );
+    return 0;
+    }
+
+/* EOF MEMWATCH-REPLAY.C */
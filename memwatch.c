@@ -113,9 +113,11 @@
 #include <string.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <time.h>
 #include <trusty_std.h>
 #include "atexit.h"
 #include "memwatch.h"
+#include "mwtrace.h"
 
 #ifndef toupper
 #include <ctype.h>
@@ -126,6 +128,12 @@
 #include <pthread.h>
 #endif
 
+#if defined(__linux__) && !defined(MW_NOMAPS) && !defined(MW_SAFEADDR)
+#define MW_HAVE_MAPS 1
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 /***********************************************************************
 ** Defines & other weird stuff
 ***********************************************************************/
@@ -140,6 +148,156 @@
 /*lint -restore */
 
 #define MW_NML      0x0001
+#define MW_SITED    0x0002  /* counted in its site's live bytes */
+#define MW_THREADED 0x0004  /* counted in its thread's live bytes */
+#define MW_CHURNED  0x10000 /* counted in its site's churn */
+#define MW_THREAD_SHIFT 17  /* the allocating thread is in the high bits */
+#define MW_THREAD_MAX 0x7FFF    /* highest thread number a block holds */
+#define mwBLOCKTHREAD(mw)   ((mw)->flag >> MW_THREAD_SHIFT)
+#define mwTHREADSLOT(n)     ((n) < MW_THREADS ? (n) : 0)
+#define MW_TAG_SHIFT 8      /* the block's tag is in bits 8-15 */
+#define mwBLOCKTAG(mw)      (((mw)->flag >> MW_TAG_SHIFT) & 0xFF)
+#define MW_QUOTA_SHIFT 3    /* the block's quota is in bits 3-7 */
+#define mwBLOCKQUOTA(mw)    (((mw)->flag >> MW_QUOTA_SHIFT) & 0x1F)
+
+#ifdef MW_HAVE_MAPS
+/* memwatch released memory which libc may have unmapped */
+#define MW_RELEASED(n)  if( (n) >= MW_MAPS_UNMAP ) mwMapsStale = 1
+#else
+#define MW_RELEASED(n)
+#endif
+
+/* without GNU C, memwatch's lock-free parts assume a single thread */
+#if defined(__GNUC__)
+#define mwBARRIER()     __sync_synchronize()
+#define mwCAS(p,o,n)    __sync_bool_compare_and_swap(p,o,n)
+#define mwATOMIC_ADD(p,n) __sync_fetch_and_add(p,n)
+#else
+#define mwBARRIER()
+#define mwCAS(p,o,n)    (*(p)==(o) ? (*(p)=(n),1) : 0)
+#define mwATOMIC_ADD(p,n) ((*(p)+=(n))-(n))
+#endif
+
+#if defined(MW_PTHREADS) || defined(HAVE_PTHREAD_H)
+#define MW_HAVE_LOGTHREAD 1
+#endif
+
+/* thread-local storage, if threads are in use */
+#if defined(MW_HAVE_MUTEX) && defined(__GNUC__)
+#define MW_TLS          __thread
+#else
+#define MW_TLS
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MW_HAVE_UNISTD 1
+#include <unistd.h>
+#endif
+
+#if defined(MW_HAVE_UNISTD) && !defined(MW_NOMMAP)
+#define MW_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
+/* process and allocator memory usage */
+#if defined(__linux__) && defined(MW_HAVE_UNISTD) && !defined(MW_NOPROC)
+#define MW_HAVE_PROC 1
+#include <fcntl.h>
+#endif
+#if defined(__GLIBC__) && !defined(MW_NOMALLINFO)
+#define MW_HAVE_MALLINFO 1
+#include <malloc.h>
+#if __GLIBC__ > 2 || ( __GLIBC__ == 2 && __GLIBC_MINOR__ >= 33 )
+#define mwMALLINFO      mallinfo2
+typedef struct mallinfo2 mwMallinfo;
+#else
+#define mwMALLINFO      mallinfo
+typedef struct mallinfo mwMallinfo;
+#endif
+#endif
+
+/* call stacks; frame pointer walking must be asked for */
+#if ( defined(__GLIBC__) || defined(__APPLE__) ) && !defined(MW_NOBACKTRACE)
+#define MW_HAVE_BACKTRACE 1
+#include <execinfo.h>
+#endif
+#if ( defined(MW_STACK_FP) && defined(__GNUC__) ) || defined(MW_HAVE_BACKTRACE)
+#define MW_HAVE_STACKS 1
+#endif
+#ifdef __GNUC__
+#define MW_NOINLINE     __attribute__((noinline))
+#else
+#define MW_NOINLINE
+#endif
+
+/*
+** Static tracepoints for perf, bpftrace and SystemTap. Each is a nop
+** with an ELF note describing where its arguments are. sys/sdt.h is
+** used if present, otherwise the notes are written here for the
+** common targets. Define MW_NOSDT to leave them out.
+*/
+#if !defined(MW_NOSDT) && ( defined(__linux__) || defined(MW_SDT) ) && defined(__GNUC__)
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define MW_HAVE_SDT_H 1
+#endif
+#endif
+#if defined(MW_HAVE_SDT_H)
+#include <sys/sdt.h>
+#define MW_HAVE_SDT 1
+#define mwPROBE4(n,a,b,c,d)         STAP_PROBE4(memwatch,n,a,b,c,d)
+#define mwPROBE5(n,a,b,c,d,e)       STAP_PROBE5(memwatch,n,a,b,c,d,e)
+#define mwPROBE6(n,a,b,c,d,e,f)     STAP_PROBE6(memwatch,n,a,b,c,d,e,f)
+#elif defined(__ELF__) && ( defined(__x86_64__) || defined(__i386__) || defined(__aarch64__) )
+#define MW_HAVE_SDT 1
+#if defined(__x86_64__) || defined(__aarch64__)
+#define mwSDT_WORD      ".8byte"
+#define mwSDT_ARG(n)    "8@%" #n
+#else
+#define mwSDT_WORD      ".4byte"
+#define mwSDT_ARG(n)    "4@%" #n
+#endif
+#define mwSDT_NOTE(name,args) \
+    "990: nop\n" \
+    ".pushsection .note.stapsdt,\"?\",\"note\"\n" \
+    ".balign 4\n" \
+    ".4byte 992f-991f,994f-993f,3\n" \
+    "991: .asciz \"stapsdt\"\n" \
+    "992: .balign 4\n" \
+    "993: " mwSDT_WORD " 990b\n" \
+    mwSDT_WORD " _.stapsdt.base\n" \
+    mwSDT_WORD " 0\n" \
+    ".asciz \"memwatch\"\n" \
+    ".asciz \"" name "\"\n" \
+    ".asciz \"" args "\"\n" \
+    "994: .balign 4\n" \
+    ".popsection\n" \
+    ".ifndef _.stapsdt.base\n" \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+    ".weak _.stapsdt.base\n" \
+    ".hidden _.stapsdt.base\n" \
+    "_.stapsdt.base: .space 1\n" \
+    ".size _.stapsdt.base,1\n" \
+    ".popsection\n" \
+    ".endif\n"
+#define mwSDT_IN(x)     "nor"((long)(x))
+#define mwPROBE4(n,a,b,c,d) __asm__ __volatile__( mwSDT_NOTE( #n, \
+    mwSDT_ARG(0) " " mwSDT_ARG(1) " " mwSDT_ARG(2) " " mwSDT_ARG(3) ) \
+    : : mwSDT_IN(a), mwSDT_IN(b), mwSDT_IN(c), mwSDT_IN(d) )
+#define mwPROBE5(n,a,b,c,d,e) __asm__ __volatile__( mwSDT_NOTE( #n, \
+    mwSDT_ARG(0) " " mwSDT_ARG(1) " " mwSDT_ARG(2) " " mwSDT_ARG(3) " " mwSDT_ARG(4) ) \
+    : : mwSDT_IN(a), mwSDT_IN(b), mwSDT_IN(c), mwSDT_IN(d), mwSDT_IN(e) )
+#define mwPROBE6(n,a,b,c,d,e,f) __asm__ __volatile__( mwSDT_NOTE( #n, \
+    mwSDT_ARG(0) " " mwSDT_ARG(1) " " mwSDT_ARG(2) " " mwSDT_ARG(3) " " mwSDT_ARG(4) " " mwSDT_ARG(5) ) \
+    : : mwSDT_IN(a), mwSDT_IN(b), mwSDT_IN(c), mwSDT_IN(d), mwSDT_IN(e), mwSDT_IN(f) )
+#endif
+#endif
+#ifndef MW_HAVE_SDT
+#define mwPROBE4(n,a,b,c,d)
+#define mwPROBE5(n,a,b,c,d,e)
+#define mwPROBE6(n,a,b,c,d,e,f)
+#endif
 
 #ifdef _MSC_VER
 #define COMMIT "c"  /* Microsoft C requires the 'c' to perform as desired */
@@ -171,6 +329,24 @@
 #define MW_MUTEX_UNLOCK()
 #endif
 
+/*
+** In the preload library, malloc() and friends are memwatch's own, so
+** memwatch must get its memory from the C library directly.
+*/
+#ifdef MW_PRELOAD
+extern void *__libc_malloc( size_t );
+extern void *__libc_calloc( size_t, size_t );
+extern void *__libc_realloc( void *, size_t );
+extern void __libc_free( void * );
+#define malloc(n)       __libc_malloc(n)
+#define calloc(n,m)     __libc_calloc(n,m)
+#define realloc(p,n)    __libc_realloc(p,n)
+#define free(p)         __libc_free(p)
+#ifndef MW_PTRHASH
+#define MW_PTRHASH
+#endif
+#endif
+
 /***********************************************************************
 ** If you really, really know what you're doing,
 ** you can predefine these things yourself.
@@ -232,6 +408,16 @@ typedef unsigned short mwDWORD;
 #endif
 #endif
 
+#ifndef mwQWORD_DEFINED
+#if defined(ULLONG_MAX) || defined(ULONG_LONG_MAX)
+typedef unsigned long long mwQWORD;
+#define mwQWORD_DEFINED "unsigned long long"
+#else
+typedef unsigned long mwQWORD;
+#define mwQWORD_DEFINED "unsigned long"
+#endif
+#endif
+
 #ifndef mwBYTE_DEFINED
 #error "can't find out the correct type for a 8 bit scalar"
 #endif
@@ -246,18 +432,38 @@ typedef unsigned short mwDWORD;
 
 /* main data holding area, precedes actual allocation */
 typedef struct mwData_ mwData;
+typedef struct mwScope_ mwScope;
 struct mwData_ {
+    /* first, so an underflow reaches them last */
+    mwScope*    scope;  /* scope allocated in, while it's open */
+    mwData*     sprev;  /* previous allocation in the scope */
+    mwData*     snext;  /* next allocation in the scope */
     mwData*     prev;   /* previous allocation in chain */
     mwData*     next;   /* next allocation in chain */
     const char* file;   /* file name where allocated */
     long        count;  /* action count */
     long        check;  /* integrity check value */
+    long        slot;   /* index in the block table */
 #if 0
     long        crc;    /* data crc value */
 #endif
     size_t      size;   /* size of allocation */
     int         line;   /* line number where allocated */
     unsigned    flag;   /* flag word */
+    unsigned    stack;  /* call stack where allocated, or zero */
+    /* free on LP64, where it fills the padding before 'born'; 32-bit
+       targets pay 4 bytes a block for it, or 8 if 'born' is 8-aligned */
+    unsigned    moves;  /* times realloc() has moved this buffer */
+    mwQWORD     born;   /* mwClockNs() when allocated, or zero */
+    };
+
+/* allocations between mwScopeBegin() and mwScopeEnd() */
+struct mwScope_ {
+    mwScope*    up;     /* enclosing scope of the thread */
+    mwData*     head;   /* live allocations made in the scope */
+    unsigned    id;
+    const char* file;   /* where it began */
+    int         line;
     };
 
 /* statistics structure */
@@ -269,6 +475,7 @@ struct mwStat_ {
     long        num;    /* total number of allocations */
     long        max;    /* max allocated at one time */
     long        curr;   /* current allocations */
+    long*       hist;   /* allocations, then live blocks, by size class */
     int         line;
     };
 
@@ -280,14 +487,230 @@ struct mwGrabData_ {
     char        blob[ 1024 - sizeof(mwGrabData*) - sizeof(int) ];
     };
 
+/* interned marker description, one per distinct mwMark() call site */
+typedef struct mwMarkSite_ mwMarkSite;
+struct mwMarkSite_ {
+    mwMarkSite* next;   /* next site in hash chain */
+    unsigned    hash;   /* hash value of text */
+    char        text[1];/* "desc called from file(line)" */
+    };
+
+/* one mwMark() call on a marker */
+typedef struct mwMarkRef_ mwMarkRef;
+struct mwMarkRef_ {
+    mwMarkRef*  next;
+    mwMarkSite* site;
+    };
+
 typedef struct mwMarker_ mwMarker;
 struct mwMarker_ {
     void *host;
-    char *text;
-    mwMarker *next;
+    mwMarker *hnext;    /* next marker in hash chain */
+    mwMarker *prev;     /* previous marker in report order */
+    mwMarker *next;     /* next marker in report order */
+    mwMarkRef *first;   /* mwMark() calls, oldest first */
+    mwMarkRef *last;
     int level;
     };
 
+/* realloc() chains ending at a site, where the last realloc() was */
+typedef struct mwGrow_ mwGrow;
+struct mwGrow_ {
+    long        reallocs;
+    long        grows;      /* reallocs that made the buffer larger */
+    long        tiny;       /* grows of less than 1/8 of the size */
+    long        ratio;      /* sum of growth factors of grows, x1000 */
+    long        copied;     /* bytes copied */
+    long        chains;     /* buffers freed after being realloc()ed */
+    long        moves;      /* sum of their realloc() counts */
+    long        longest;    /* most realloc()s of one buffer */
+    long        final[MW_HIST_CLASSES]; /* their final sizes */
+    };
+
+/* allocation churn at a site */
+typedef struct mwChurnSite_ mwChurnSite;
+struct mwChurnSite_ {
+    long        allocs;
+    long        frees;
+    long        bytes;
+    size_t      size;       /* size of the first allocation */
+    long        same;       /* allocations of that size */
+    long        live;       /* blocks allocated and not yet freed */
+    long        maxlive;
+    long        livesum;    /* sum of 'live' at each allocation */
+    };
+
+/* allocation site, identified by the file name pointer and line */
+/* lifetimes of a site's blocks; the classes are powers of two */
+#define mwLIFECLASSES 64
+typedef struct mwLife_ mwLife;
+struct mwLife_ {
+    long        allocs; /* blocks allocated while tracking */
+    long        frees;  /* and freed */
+    long        ops[mwLIFECLASSES];
+    long        ns[mwLIFECLASSES];
+    };
+
+/* live blocks of a site over the last leak windows */
+typedef struct {
+    long        live[MW_LEAK_WINDOWS];  /* blocks at the end of each window, newest first */
+    long        age[MW_LEAK_WINDOWS];   /* live blocks by age in windows */
+    int         windows;    /* windows seen, up to MW_LEAK_WINDOWS */
+    int         score;
+    } mwLeak;
+
+/* unfreed blocks of a site, summed at exit */
+typedef struct {
+    long        bytes;
+    long        blocks;
+    long        damaged;    /* blocks under- or overflowed */
+    int         samples;
+    void*       sample[MW_UNFREED_SAMPLES];
+    char        dump[16*3+16+1];    /* first bytes of the first sample */
+    } mwUnfreedSite;
+
+typedef struct mwSite_ mwSite;
+struct mwSite_ {
+    mwSite*     next;   /* next site in hash chain */
+    const char* file;
+    int         line;
+    unsigned    id;     /* site number in event traces */
+    unsigned    gen;    /* trace file the site was last written to */
+    unsigned    fgen;   /* flight recorder the site was last written to */
+    int         skip;   /* filtered out of the event trace */
+    mwStat*     mod;    /* module statistics, once looked up */
+    mwStat*     stat;   /* line statistics, once looked up */
+    mwLife*     life;   /* block lifetimes, if tracked */
+    mwGrow*     grow;   /* realloc() chains, if any */
+    mwChurnSite* churn; /* allocation churn, if tracked */
+    mwLeak*     leak;   /* leak suspect history, if watched */
+    mwUnfreedSite*  unfreed; /* unfreed blocks, at exit */
+    long        livebytes;  /* live bytes of MW_SITED blocks */
+    long        liveblocks;
+    unsigned    qgen;   /* quota set the next one is from */
+    unsigned    quota;  /* quota charged for the site, or zero */
+    unsigned    peakgen; /* peak capture the next two are from */
+    long        peakbytes;
+    long        peakblocks;
+    };
+
+/* a site's share of the heap at its peak */
+typedef struct {
+    const char* file;
+    int         line;
+    long        bytes;
+    long        blocks;
+    } mwPeakEntry;
+
+/* one point of the usage timeline */
+typedef struct {
+    long        counter;
+    mwQWORD     ns;         /* since the timeline started */
+    long        bytes;
+    long        blocks;
+    long        nml;        /* no-mans-land bytes */
+    long        overhead;   /* memwatch's headers, guards and no-mans-land */
+    long        heap;       /* the C library's heap, or -1 */
+    long        rss;        /* resident set size, or -1 */
+    int         sites;
+    mwPeakEntry site[MW_TIMELINE_TOP];  /* largest sites, by live bytes */
+    } mwTimePoint;
+
+/* allocations by one thread; slot 0 has the threads past MW_THREADS */
+typedef struct {
+    long        allocs;
+    long        bytes;
+    long        frees;
+    long        livebytes;
+    long        liveblocks;
+    long        remote;     /* of its blocks, freed by another thread */
+    } mwThreadStat;
+
+/* memory charged to a tag; updated without the lock */
+typedef struct {
+    const char* name;
+    volatile long allocs;
+    volatile long frees;
+    volatile long cur;
+    volatile long peak;
+    volatile long total;
+    } mwTagStat;
+
+/* a budget for the blocks of some files or of a tag */
+typedef struct {
+    char*       match;  /* "tag:name", or part of a file name */
+    unsigned    tag;    /* the tag, for a tag quota */
+    long        soft;   /* call func when passed, if nonzero */
+    long        hard;   /* fail allocations past it, if nonzero */
+    void        (*func)( const char *match, long bytes );
+    long        cur;
+    long        peak;
+    int         over;   /* past the soft limit, func has been called */
+    long        softs;  /* times the soft limit was passed */
+    long        fails;  /* allocations failed by the hard limit */
+    } mwQuotaDef;
+
+/* a ranked leak suspect */
+typedef struct {
+    const char* file;
+    int         line;
+    long        bytes;
+    long        blocks;
+    long        old;        /* blocks older than MW_LEAK_OLD windows */
+    int         score;
+    } mwLeakEntry;
+
+/* call stack in the stack depot */
+typedef struct mwStack_ mwStack;
+struct mwStack_ {
+    mwStack*    next;   /* next stack in hash chain */
+    unsigned    hash;
+    unsigned    id;
+    int         depth;
+    long        num;    /* allocations made from here */
+    long        total;  /* bytes allocated from here */
+    long        curnum; /* blocks still allocated */
+    long        curr;   /* bytes still allocated */
+    void*       pc[1];  /* return addresses, innermost first */
+    };
+
+/* live blocks of one site in a heap snapshot */
+typedef struct {
+    const char* file;
+    int         line;
+    long        num;    /* live blocks */
+    long        bytes;  /* live bytes */
+    long        first;  /* lowest mwCounter among them */
+    long        last;   /* highest mwCounter among them */
+    } mwSnapSite;
+
+/* a site's growth between two snapshots */
+typedef struct {
+    const mwSnapSite* now;
+    long        num;
+    long        bytes;
+    } mwSnapGrowth;
+
+struct mwSnap_ {
+    long        counter;    /* mwCounter when taken */
+    long        num;        /* live blocks */
+    long        bytes;      /* live bytes */
+    long        sites;
+    mwSnapSite  site[1];    /* sorted by file and line */
+    };
+
+/* per-thread event trace buffer */
+typedef struct mwRecBuf_ mwRecBuf;
+struct mwRecBuf_ {
+    mwRecBuf*   next;   /* next buffer in mwRecBufs */
+    unsigned    thread; /* owning thread, or zero if unused */
+    unsigned    len;    /* bytes used in data[] */
+    unsigned long counter; /* previous event, for deltas */
+    mwQWORD     time;
+    unsigned long addr;
+    unsigned char data[MW_REC_CHUNK];
+    };
+
 #if defined(WIN32) || defined(__WIN32__)
 typedef HANDLE          mwMutex;
 #endif
@@ -317,6 +740,10 @@ static unsigned char mwOverflowZoneTemplate[] = "mEmwAtch";
 static int        mwOverflowZoneSize = mwROUNDALLOC;
 
 static void     (*mwOutFunction)(int) = NULL;
+static void     (*mwOutSink)(const char*,unsigned) = NULL;
+static int      mwOutFd =       2;
+static FILE*    mwOutFile =     NULL;
+static int      mwFlushing =    0;
 static int      (*mwAriFunction)(const char*) = NULL;
 static int      mwAriAction = MW_ARI_ABORT;
 
@@ -327,11 +754,15 @@ static int      mwTestFlags =   0;
 static int      mwTestAlways =  1;
 
 static mwStat*  mwStatList = NULL;
+static long     mwHistAlloc[MW_HIST_CLASSES];
+static long     mwHistLive[MW_HIST_CLASSES];
 static long     mwStatTotAlloc = 0L;
 static long     mwStatMaxAlloc = 0L;
 static long     mwStatNumAlloc = 0L;
 static long     mwStatCurAlloc = 0L;
 static long     mwNmlNumAlloc = 0L;
+static long     mwStatNumRealloc = 0L;
+static long     mwStatCopied =  0L;
 static long     mwNmlCurAlloc = 0L;
 
 static mwGrabData* mwGrabList = NULL;
@@ -341,21 +772,200 @@ static void *   mwLastFree[MW_FREE_LIST];
 static const char *mwLFfile[MW_FREE_LIST];
 static int      mwLFline[MW_FREE_LIST];
 static int      mwLFcur = 0;
+static unsigned mwLFstack[MW_FREE_LIST];
+
+static int      mwStackLevel =  MW_STACK_NONE;
+static mwStack* mwStackTable[MW_STACK_HASH];
+static mwStack** mwStackById =  NULL;
+static unsigned mwStackCount =  0;
+static unsigned mwStackMax =    0;
+static MW_TLS unsigned mwStackNext = 0;
+
+static int      mwLifeOn =      0;
+static int      mwChurnOn =     0;
+static long     mwChurnSince =  0L;
+
+static int      mwPeakOn =      0;
+static int      mwPeakDirty =   0;      /* a new peak has not been captured */
+static unsigned mwPeakGen =     0;
+static long     mwPeakBytes =   0L;     /* heap usage at the last capture */
+static long     mwPeakBlocks =  0L;
+static long     mwPeakCounter = 0L;
+static long     mwPeakUsed =    0L;
+static mwPeakEntry mwPeakTop[MW_PEAK_SITES];
+
+static int      mwSiteLive =    0;      /* keep the live bytes of each site */
+static int      mwTimeOn =      0;
+static mwTimePoint* mwTime =    NULL;
+static int      mwTimeUsed =    0;
+static long     mwTimeOps =     0L;     /* sample every this many operations */
+static unsigned long mwTimeNext = 0L;   /* at this mwCounter */
+static mwQWORD  mwTimeNs =      0;      /* or every this many nanoseconds */
+static mwQWORD  mwTimeNsNext =  0;
+static mwQWORD  mwTimeStart =   0;
+static int      mwTimeProc =    0;      /* samples since heap and RSS were read */
+
+static int      mwLeakOn =      0;
+static int      mwLeakLog =     0;      /* log the suspects after each window */
+static mwQWORD  mwLeakNs =      0;      /* length of a window */
+static mwQWORD  mwLeakEnd =     0;      /* end of the current window */
+static long     mwLeakMark[MW_LEAK_WINDOWS];    /* mwCounter at the start of each window */
+static long     mwLeakWindows = 0L;
+static int      mwLeakUsed =    0;
+static mwLeakEntry mwLeakTop[MW_LEAK_TOP];
 
 static mwMarker* mwFirstMark = NULL;
 
+/* out-of-line block table, one array per mwData member */
+static int      mwOOL =         0;
+static int      mwUnfreedTop =  0;      /* sites listed at exit, or zero for every block */
+static int      mwFastQuit =    0;      /* don't release the heap at exit */
+static long     mwTabUsed =     0L;
+static long     mwTabMax =      0L;
+static mwData** mwTabMW =       NULL;
+static size_t*  mwTabSize =     NULL;
+static const char** mwTabFile = NULL;
+static int*     mwTabLine =     NULL;
+static long*    mwTabCount =    NULL;
+static unsigned* mwTabFlag =    NULL;
+
+#ifdef MW_PTRHASH
+/* every block in the chain, by address, so that mwOwned() is exact */
+#define MW_PTR_GONE     ((mwData*) 1)
+static mwData** mwPtrHash =     NULL;
+static long     mwPtrMax =      0L;     /* slots, a power of two */
+static long     mwPtrUsed =     0L;     /* slots ever filled, tombstones included */
+static long     mwPtrLive =     0L;
+static volatile int mwPtrBusy = 0;
+#endif
+static mwMarker* mwMarkTable[MW_MARK_HASH];
+static mwMarkSite* mwMarkSites[MW_MARK_HASH];
+
 #ifdef MW_HAVE_MUTEX
 static mwMutex    mwGlobalMutex;
 #endif
 
-#define mw_printf(fmt, ...) \
-    fprintf(stderr, "\033[32m" fmt "\033[0m\n",  ##__VA_ARGS__)
+#ifdef MW_HAVE_MAPS
+static volatile int mwMapsStale = 1;
+#endif
+
+static MW_TLS unsigned mwThisThread = 0;
+static volatile unsigned mwThreadCount = 0;
+static int      mwThreadOn =    0;
+static mwThreadStat mwThreadStats[MW_THREADS];
+static long     mwThreadFrees[MW_THREADS][MW_THREADS];  /* blocks, by allocating and freeing thread */
+static long     mwThreadBytes[MW_THREADS][MW_THREADS];
+static mwTagStat mwTags[MW_TAGS+1];    /* tag zero is untagged */
+static volatile int mwTagCount = 0;
+static MW_TLS unsigned char mwTagStack[MW_TAG_DEPTH];
+static MW_TLS int mwTagDepth =  0;
+static MW_TLS int mwTagNext =   -1;     /* realloc() keeps the block's tag */
+
+static mwQuotaDef mwQuotas[MW_QUOTAS+1];    /* quota zero is none */
+static int      mwQuotaCount =  0;
+static int      mwQuotaFiles =  0;      /* quotas by file name */
+static unsigned mwQuotaGen =    1;
+static unsigned char mwTagQuota[MW_TAGS+1];
+static MW_TLS int mwQuotaPending = 0;   /* soft limit passed, func not yet called */
+static MW_TLS int mwQuotaHold = 0;      /* inside realloc(), don't call func yet */
+static MW_TLS unsigned mwQuotaFrom = 0; /* realloc() frees this much of this quota */
+static MW_TLS long mwQuotaCredit = 0L;
+
+static long     mwMemEnd[MW_MEM_COUNT];
+static int      mwMemEndOk =    0;
+
+static MW_TLS mwScope* mwScopeTop = NULL;
+static MW_TLS mwScope* mwScopeNext = NULL;  /* realloc() keeps the block's scope */
+static MW_TLS int mwScopeKeep = 0;
+static unsigned mwScopeCount =  0;
+static long     mwScopeLeaky =  0L;     /* scopes that ended with survivors */
+static long     mwScopeBlocks = 0L;     /* and what survived them */
+static long     mwScopeBytes =  0L;
+#ifdef MW_HAVE_MUTEX
+static MW_TLS int mwThreadKeyed = 0;
+static pthread_key_t mwThreadKey;
+static int      mwThreadKeyMade = 0;
+#endif
+
+static mwSite*  mwSiteTable[MW_SITE_HASH];
+static unsigned mwSiteCount =   0;
+
+static FILE*    mwRecFile =     NULL;
+static unsigned mwRecGen =      0;
+static mwRecBuf* mwRecBufs =    NULL;
+static MW_TLS mwRecBuf* mwRecMine = NULL;
+static const char* mwRecOnly =  NULL;
+static int      mwRecOnlyLine = 0;
+static size_t   mwRecMin =      0;
+static size_t   mwRecMax =      0;
+#ifdef MW_HAVE_MUTEX
+static pthread_key_t mwRecKey;
+static int      mwRecKeyMade =  0;
+#endif
+
+static mwfHeader* mwFlight =    NULL;
+static unsigned mwFlightGen =   0;
+static size_t   mwFlightSize =  0;
+static int      mwFlightFd =    -1;
+static MW_TLS mwfRing* mwFlightMine = NULL;
+static MW_TLS unsigned mwFlightMyGen = 0;
+#if MW_FLIGHT_STATIC > 0
+static mwQWORD  mwFlightStatic[MW_FLIGHT_STATIC/sizeof(mwQWORD)];
+#endif
+
+/*
+** All diagnostics are queued in a lock-free ring of fixed-size slots,
+** and written to the sink by whoever drains it; see mwLogPut().
+** Slot i is free for ticket t when mwLogRing[i].seq+i == t, and
+** holds a message for ticket t when it's t+1.
+*/
+typedef struct mwLogSlot_ mwLogSlot;
+struct mwLogSlot_ {
+    volatile unsigned long seq;
+    unsigned    len;
+    char        text[MW_LOG_SLOT];
+    };
+
+static mwLogSlot mwLogRing[MW_LOG_SLOTS];
+static volatile unsigned long mwLogHead = 0L;  /* next ticket to hand out */
+static unsigned long mwLogTail =    0L;         /* next ticket to write out */
+static volatile int mwLogBusy =     0;          /* someone is draining */
+static volatile unsigned long mwLogLostCount = 0L;
+static unsigned long mwLogLostTold = 0L;
+static int      mwLogModeSel =      MW_LOG_SYNC;
+static int      mwLogPolicySel =    MW_LOG_BLOCK;
+static int      mwLogColored =      1;
+#ifdef MW_HAVE_LOGTHREAD
+static pthread_t mwLogThread;
+static volatile int mwLogRunning =  0;
+#endif
+
+#define mw_printf   mwLog
 
 /***********************************************************************
 ** Static function declarations
 ***********************************************************************/
 
 static void     mwAutoInit( void );
+static void     mwLog( const char *format, ... );
+static void     mwLogPut( const char *text, unsigned len );
+static int      mwLogDrain( void );
+static void     mwLogWrite( const char *text, unsigned len );
+static void     mwLogStop( void );
+static mwQWORD  mwClockNs( void );
+static unsigned mwThreadNum( void );
+static mwSite*  mwSiteGet( const char *file, int line );
+static mwSite** mwSiteList( int (*want)( mwSite *site ), int (*order)( const void *a, const void *b ), long *count );
+static const char* mwSiteName( char *buf, const char *file, int line );
+static void     mwEvent( int type, const char *file, int line, size_t size,
+                    const void *p, const void *oldp, size_t oldsize, long age );
+static void     mwRecEvent( int type, mwSite *site, size_t size,
+                    const void *p, const void *oldp, size_t oldsize, long age );
+static void     mwFlightEvent( int type, mwSite *site, size_t size,
+                    const void *p, mwQWORD aux );
+static mwfRing* mwFlightRingGet( void );
+static void     mwRecFlush( mwRecBuf *rb );
+static unsigned char *mwRecVar( unsigned char *o, mwQWORD v );
 static void     mwUnlink( mwData*, const char* file, int line );
 static int      mwRelink( mwData*, const char* file, int line );
 static int      mwIsHeapOK( mwData *mw );
@@ -364,6 +974,26 @@ static int      mwTestBuf( mwData* mw, const char* file, int line );
 static size_t   mwFreeUp( size_t, int );
 static const void *mwTestMem( const void *, unsigned, int );
 static int      mwStrCmpI( const char *s1, const char *s2 );
+static mwMarker* mwMarkFind( void *p, unsigned *bucket );
+static mwMarkSite* mwMarkIntern( const char *text );
+static void     mwMarkReport( void );
+static void     mwUnfreedDump( mwData *mw, char *dump );
+static void     mwUnfreedAdd( mwData *mw );
+static void     mwUnfreedReport( void );
+static int      mwTabGrow( void );
+static void     mwTabAdd( mwData *mw );
+static void     mwTabDel( mwData *mw );
+static long     mwTabFind( mwData *mw );
+static void     mwTabUpdate( mwData *mw );
+static int      mwTabIntact( long i );
+static void     mwTabRestore( long i, const char *file, int line );
+static int      mwTabTest( long i, const char *file, int line );
+#ifdef MW_PTRHASH
+static int      mwPtrRoom( void );
+static void     mwPtrAdd( mwData *mw );
+static void     mwPtrDel( mwData *mw );
+static int      mwPtrFind( mwData *mw );
+#endif
 static int      mwTestNow( const char *file, int line, int always_invoked );
 static void     mwDropAll( void );
 static const char *mwGrabType( int type );
@@ -371,7 +1001,45 @@ static unsigned mwGrab_( unsigned kb, int type, int silent );
 static unsigned mwDrop_( unsigned kb, int type, int silent );
 static int      mwARI( const char* text );
 static void     mwStatReport( void );
+static unsigned mwStackCapture( int skip );
+static unsigned mwStackIntern( void **pc, int depth );
+static void     mwStackAdd( unsigned id, long size );
+static void     mwStackPrint( unsigned id );
+static void     mwStackReport( void );
+static void     mwStackFree( void );
+static int      mwSnapCmp( const void *a, const void *b );
+static int      mwSnapByGrowth( const void *a, const void *b );
+static mwLife*  mwLifeGet( const char *file, int line );
+static int      mwLifeClass( mwQWORD v );
+static void     mwLifeReport( void );
 static mwStat*  mwStatGet( const char*, int, int );
+static int      mwSizeClass( size_t size );
+static void     mwHistReport( const char *name, const long *hist );
+static long     mwHistPct( const long *hist, unsigned long *pct );
+static mwGrow*  mwGrowGet( const char *file, int line );
+static void     mwGrowAdd( mwData *from, mwData *to, const char *file, int line );
+static void     mwGrowReport( void );
+static mwChurnSite* mwChurnGet( const char *file, int line );
+static void     mwChurnReport( void );
+static void     mwPeakCapture( void );
+static void     mwPeakReport( void );
+static void     mwTimeSample( void );
+static void     mwTimeChart( FILE *f );
+static long     mwProcRss( int rollup, long *anon );
+static long     mwHeapSize( long *inuse );
+static int      mwMemTake( long *usage );
+static void     mwMemReport( void );
+static void     mwLeakWindow( void );
+static int      mwScopeLinked( mwData *mw );
+static void     mwScopeRepair( mwData *mw );
+static void     mwLeakReport( const char *title );
+static void     mwThreadOwned( unsigned num );
+static void     mwThreadReport( void );
+static void     mwTagReport( void );
+static unsigned mwTagFind( const char *name );
+static unsigned mwQuotaOf( const char *file, int line, unsigned tag );
+static void     mwQuotaNotify( void );
+static void     mwQuotaReport( void );
 static void     mwStatAlloc( size_t, const char*, int );
 static void     mwStatFree( size_t, const char*, int );
 static int        mwCheckOF( const void * p );
@@ -391,6 +1059,9 @@ void mwAbort_atexit(void *a){
     mwAbort();
 }
 void mwInit( void ) {
+    mwSite *site;
+    int i;
+
     if( mwInited++ > 0 ) return;
 
     MW_MUTEX_INIT();
@@ -402,6 +1073,22 @@ void mwInit( void ) {
     mwStatNumAlloc = 0L;
     mwNmlCurAlloc = 0L;
     mwNmlNumAlloc = 0L;
+    mwStatNumRealloc = 0L;
+    mwStatCopied = 0L;
+    memset( mwHistAlloc, 0, sizeof(mwHistAlloc) );
+    memset( mwHistLive, 0, sizeof(mwHistLive) );
+    for( i=0; i<MW_SITE_HASH; i++ )
+        for( site=mwSiteTable[i]; site; site=site->next ) {
+            site->mod = site->stat = NULL;
+            free( site->life );
+            free( site->grow );
+            free( site->churn );
+            free( site->leak );
+            site->life = NULL;
+            site->grow = NULL;
+            site->churn = NULL;
+            site->leak = NULL;
+            }
 
     /* calculate the buffer size to use for a mwData */
     mwDataSize = sizeof(mwData);
@@ -476,10 +1163,10 @@ void mwInit( void ) {
 
 void mwAbort( void ) {
     mwData *mw;
-    mwMarker *mrk;
     char *data;
-    int c, i, j;
     int errors;
+    char dump[16*3+16+1];
+    char sid[32];
 
     mw_printf( "\nStopped at\n");
 
@@ -490,13 +1177,28 @@ void mwAbort( void ) {
     mwDropAll();
 
     /* report mwMarked items */
-    while( mwFirstMark ) {
-        mrk = mwFirstMark->next;
-        mw_printf( "mark: %p: %s\n", mwFirstMark->host, mwFirstMark->text );
-        free( mwFirstMark->text );
-        free( mwFirstMark );
-        mwFirstMark = mrk;
-        mwErrors ++;
+    mwMarkReport();
+
+    /* the heap as it is, before the unfreed blocks go */
+    mwMemEndOk = mwInited && mwMemTake( mwMemEnd );
+    if( mwPeakDirty ) mwPeakCapture();
+
+    /* with a fast exit, only sum up the unfreed blocks */
+    if( mwFastQuit ) {
+        for( mw=mwHead; mw; mw=mw->next ) {
+            if( !mwIsOwned( mw, __FILE__, __LINE__ ) ) {
+                mw_printf( "internal: unfreed scan aborted, heap too damaged\n" );
+                break;
+                }
+            if( mw->flag & MW_NML ) continue;
+            mwErrors++;
+            mwUnfreedAdd( mw );
+            }
+        /* the blocks stay allocated, but memwatch no longer tracks them */
+        mwNmlNumAlloc = mwNmlCurAlloc = 0L;
+        mwNumCurAlloc = 0L;
+        mwHead = mwTail = NULL;
+        mwTabUsed = 0;
         }
 
     /* release all still allocated memory */
@@ -515,32 +1217,24 @@ void mwAbort( void ) {
             
             break;
             }
-        if( !(mwHead->flag & MW_NML) ) {
+        if( !(mwHead->flag & MW_NML) && mwUnfreedTop ) {
+            mwErrors++;
+            mwUnfreedAdd( mwHead );
+            mw = mwHead;
+            mwUnlink( mw, __FILE__, __LINE__ );
+            free( mw );
+            }
+        else if( !(mwHead->flag & MW_NML) ) {
             mwErrors++;
             data = ((char*)mwHead)+mwDataSize;
-            mw_printf( "unfreed: <%ld> %s(%d), %ld bytes at %p ",
-                mwHead->count, mwHead->file, mwHead->line, (long)mwHead->size, data+mwOverflowZoneSize );
-            if( mwCheckOF( data ) ) {
-                mw_printf( "[underflowed] ");
-                
-                }
-            if( mwCheckOF( (data+mwOverflowZoneSize+mwHead->size) ) ) {
-                mw_printf( "[overflowed] ");
-                
-                }
-            printf( " \t{" );
-            j = 16; if( mwHead->size < 16 ) j = (int) mwHead->size;
-            for( i=0;i<16;i++ ) {
-                if( i<j ) printf( "%02X ",
-                    (unsigned char) *(data+mwOverflowZoneSize+i) );
-                else printf( ".. " );
-                }
-            for( i=0;i<j;i++ ) {
-                c = *(data+mwOverflowZoneSize+i);
-                if( c < 32 || c > 126 ) c = '.';
-                printf( "%c", c );
-                }
-            printf( "}\n" );
+            mwUnfreedDump( mwHead, dump );
+            if( mwHead->stack ) sprintf( sid, "[stack #%u] ", mwHead->stack );
+            else sid[0] = 0;
+            mw_printf( "unfreed: <%ld> %s(%d), %ld bytes at %p %s%s%s \t{%s}\n",
+                mwHead->count, mwHead->file, mwHead->line, (long)mwHead->size, data+mwOverflowZoneSize,
+                mwCheckOF( data ) ? "[underflowed] " : "",
+                mwCheckOF( (data+mwOverflowZoneSize+mwHead->size) ) ? "[overflowed] " : "",
+                sid, dump );
             mw = mwHead;
             mwUnlink( mw, __FILE__, __LINE__ );
             free( mw );
@@ -563,17 +1257,25 @@ void mwAbort( void ) {
 
     if( mwNmlNumAlloc ) mw_printf("internal: NoMansLand block counter %ld, not zero\n", mwNmlNumAlloc );
     if( mwNmlCurAlloc ) mw_printf("internal: NoMansLand byte counter %ld, not zero\n", mwNmlCurAlloc );
+    if( mwUnfreedTop || mwFastQuit ) mwUnfreedReport();
 
     /* report statistics */
     mwStatReport();
+    mwRecordClose();
+    mwFlightClose();
+    mwStackFree();
     
 
     mwInited = 0;
     mwHead = mwTail = NULL;
+    mwTabUsed = 0;
     if( mwErrors )
         mw_printf("MEMWATCH detected %ld anomalies\n",mwErrors);
     mwErrors = 0;
 
+    mwLogStop();
+    mwFlushNow();
+
     MW_MUTEX_TERM();
 
     }
@@ -590,6 +1292,14 @@ void mwTerm( void ) {
         mwInited --;
     }
 
+void mwUnfreed( int top, int fast ) {
+    mwAutoInit();
+    MW_MUTEX_LOCK();
+    mwUnfreedTop = top > 0 ? top : 0;
+    mwFastQuit = fast;
+    MW_MUTEX_UNLOCK();
+    }
+
 void mwStatistics( int level )
 {
     mwAutoInit();
@@ -608,11 +1318,45 @@ void mwAutoCheck( int onoff ) {
     if( onoff ) mwTestFlags = MW_TEST_ALL;
     }
 
+void mwOutOfLine( int onoff ) {
+    mwData *mw;
+    mwAutoInit();
+    MW_MUTEX_LOCK();
+    if( onoff && !mwOOL ) {
+        mwOOL = 1;
+        mwTabUsed = 0;
+        for( mw=mwTail; mw; mw=mw->prev ) mwTabAdd( mw );
+        if( mwTabUsed != mwNumCurAlloc + mwNmlNumAlloc )
+            mw_printf( "internal: block table has %ld entries, expected %ld\n",
+                mwTabUsed, mwNumCurAlloc + mwNmlNumAlloc );
+        }
+    if( !onoff && mwOOL ) {
+        mwOOL = 0;
+        free( mwTabMW );
+        mwTabMW = NULL;
+        mwTabUsed = mwTabMax = 0;
+        }
+    MW_MUTEX_UNLOCK();
+    }
+
 void mwSetOutFunc( void (*func)(int) ) {
     mwAutoInit();
+    mwFlushNow();
     mwOutFunction = func;
     }
 
+void mwSetOutSink( void (*func)(const char*,unsigned) ) {
+    mwAutoInit();
+    mwFlushNow();
+    mwOutSink = func;
+    }
+
+void mwSetOutFd( int fd ) {
+    mwAutoInit();
+    mwFlushNow();
+    mwOutFd = fd;
+    }
+
 static void mwWriteOF( void *p )
 {
     int i;
@@ -669,12 +1413,15 @@ void mwBreakOut( const char* cause ) {
     }
 
 /*
-** 981217 JLI: is it possible that ->next is not always set?
+** Markers are kept in a hash table keyed on the host pointer, and
+** also on a doubly linked list in mwFirstMark so that mwAbort() can
+** report them newest first. Each mwMark() call appends a reference
+** to an interned description, so re-marking doesn't copy strings.
 */
 void * mwMark( void *p, const char *desc, const char *file, unsigned line ) {
     mwMarker *mrk;
-    unsigned n, isnew;
-    char *buf;
+    mwMarkRef *ref;
+    unsigned bucket;
     int tot, oflow = 0;
     char wherebuf[128];
 
@@ -692,64 +1439,40 @@ void * mwMark( void *p, const char *desc, const char *file, unsigned line ) {
         return p;
         }
 
-    if( mwFirstMark != NULL && !mwIsReadAddr( mwFirstMark, sizeof( mwMarker ) ) )
-    {
-        mw_printf("mark: %s(%d), mwFirstMark (%p) is trashed, can't mark for %s\n",
-            file, line, mwFirstMark, desc );
+    ref = (mwMarkRef*) malloc( sizeof( mwMarkRef ) );
+    if( ref == NULL || (ref->site = mwMarkIntern( wherebuf )) == NULL ) {
+        if( ref ) free( ref );
+        mw_printf("mark: %s(%d), no mark for %p:'%s', out of memory\n", file, line, p, desc );
         return p;
-    }
-
-    for( mrk=mwFirstMark; mrk; mrk=mrk->next )
-    {
-        if( mrk->next != NULL && !mwIsReadAddr( mrk->next, sizeof( mwMarker ) ) )
-        {
-            mw_printf("mark: %s(%d), mark(%p)->next(%p) is trashed, can't mark for %s\n",
-                file, line, mrk, mrk->next, desc );
-            return p;
         }
-        if( mrk->host == p ) break;
-    }
+    ref->next = NULL;
 
+    mrk = mwMarkFind( p, &bucket );
     if( mrk == NULL ) {
-        isnew = 1;
         mrk = (mwMarker*) malloc( sizeof( mwMarker ) );
         if( mrk == NULL ) {
+            free( ref );
             mw_printf("mark: %s(%d), no mark for %p:'%s', out of memory\n", file, line, p, desc );
             return p;
             }
-        mrk->next = NULL;
-        n = 0;
-        }
-    else {
-        isnew = 0;
-        n = strlen( mrk->text );
-        }
-
-    n += strlen( wherebuf );
-    buf = (char*) malloc( n+3 );
-    if( buf == NULL ) {
-        if( isnew ) free( mrk );
-        mw_printf("mark: %s(%d), no mark for %p:'%s', out of memory\n", file, line, p, desc );
-        return p;
-        }
-
-    if( isnew ) {
-        memcpy( buf, wherebuf, n+1 );
-        mrk->next = mwFirstMark;
         mrk->host = p;
-        mrk->text = buf;
         mrk->level = 1;
+        mrk->first = mrk->last = ref;
+        mrk->hnext = mwMarkTable[bucket];
+        mwMarkTable[bucket] = mrk;
+        mrk->prev = NULL;
+        mrk->next = mwFirstMark;
+        if( mwFirstMark ) mwFirstMark->prev = mrk;
         mwFirstMark = mrk;
         }
     else {
-        strcpy( buf, mrk->text );
-        strcat( buf, ", " );
-        strcat( buf, wherebuf );
-        free( mrk->text );
-        mrk->text = buf;
+        mrk->last->next = ref;
+        mrk->last = ref;
         mrk->level ++;
         }
 
+    if( mwRecFile || mwFlight ) mwEvent( MWT_MARK, file, (int) line, 0, p, NULL, 0, 0 );
+
     if( oflow ) {
         mw_printf( " [WARNING: OUTPUT BUFFER OVERFLOW - SYSTEM UNSTABLE]\n" );
         }
@@ -757,29 +1480,2227 @@ void * mwMark( void *p, const char *desc, const char *file, unsigned line ) {
     }
 
 void* mwUnmark( void *p, const char *file, unsigned line ) {
-    mwMarker *mrk, *prv;
-    mrk = mwFirstMark;
-    prv = NULL;
-    while( mrk ) {
-        if( mrk->host == p ) {
-            if( mrk->level < 2 ) {
-                if( prv ) prv->next = mrk->next;
-                else mwFirstMark = mrk->next;
-                free( mrk->text );
-                free( mrk );
-                return p;
+    mwMarker *mrk, **pp;
+    mwMarkRef *ref;
+    unsigned bucket;
+
+    mrk = mwMarkFind( p, &bucket );
+    if( mrk == NULL ) {
+        mw_printf("mark: %s(%d), no mark found for %p\n", file, line, p );
+        return p;
+        }
+    if( mwRecFile || mwFlight ) mwEvent( MWT_UNMARK, file, (int) line, 0, p, NULL, 0, 0 );
+    if( mrk->level > 1 ) {
+        mrk->level --;
+        return p;
+        }
+
+    for( pp=&mwMarkTable[bucket]; *pp!=mrk; pp=&(*pp)->hnext ) ;
+    *pp = mrk->hnext;
+    if( mrk->prev ) mrk->prev->next = mrk->next;
+    else mwFirstMark = mrk->next;
+    if( mrk->next ) mrk->next->prev = mrk->prev;
+    while( mrk->first ) {
+        ref = mrk->first->next;
+        free( mrk->first );
+        mrk->first = ref;
+        }
+    free( mrk );
+    return p;
+    }
+
+/***********************************************************************
+** Log output
+***********************************************************************/
+
+void mwTrace( const char *format, ... ) {
+    char buffer[MW_TRACE_BUFFER];
+    va_list mark;
+    int n;
+
+    mwAutoInit();
+    va_start( mark, format );
+    n = vsnprintf( buffer, sizeof(buffer), format, mark );
+    va_end( mark );
+    if( n < 0 ) return;
+    if( n >= (int) sizeof(buffer) ) n = (int) sizeof(buffer) - 1;
+    mwLogPut( buffer, (unsigned) n );
+    }
+
+void mwPuts( const char *text ) {
+    mwAutoInit();
+    mwLogPut( text, (unsigned) strlen( text ) );
+    mwLogPut( "\n", 1 );
+    }
+
+void mwFlushNow( void ) {
+    while( mwLogDrain() ) ;
+    if( mwOutFunction == NULL && mwOutSink == NULL && mwOutFile != NULL )
+        fflush( mwOutFile );
+    }
+
+void mwDoFlush( int onoff ) {
+    mwFlushing = onoff;
+    if( onoff ) mwFlushNow();
+    }
+
+void mwLogColor( int onoff ) {
+    mwLogColored = onoff;
+    }
+
+void mwLogPolicy( int policy ) {
+    mwLogPolicySel = policy;
+    }
+
+unsigned long mwLogLost( void ) {
+    return mwLogLostCount;
+    }
+
+#ifdef MW_HAVE_LOGTHREAD
+static void *mwLogWriter( void *arg ) {
+    struct timespec ts;
+    arg = arg;
+    ts.tv_sec = 0;
+    ts.tv_nsec = 1000000L;
+    while( mwLogRunning ) {
+        if( !mwLogDrain() ) nanosleep( &ts, NULL );
+        }
+    return NULL;
+    }
+#endif
+
+void mwLogMode( int mode ) {
+    if( mode == mwLogModeSel ) return;
+    mwLogStop();
+#ifdef MW_HAVE_LOGTHREAD
+    if( mode == MW_LOG_THREAD ) {
+        mwLogRunning = 1;
+        if( pthread_create( &mwLogThread, NULL, mwLogWriter, NULL ) ) {
+            mwLogRunning = 0;
+            mode = MW_LOG_DEFER;
+            }
+        }
+#else
+    if( mode == MW_LOG_THREAD ) mode = MW_LOG_DEFER;
+#endif
+    mwLogModeSel = mode;
+    if( mode == MW_LOG_SYNC ) mwFlushNow();
+    }
+
+/* stops the writer thread, if there is one */
+static void mwLogStop( void ) {
+#ifdef MW_HAVE_LOGTHREAD
+    if( mwLogRunning ) {
+        mwLogRunning = 0;
+        pthread_join( mwLogThread, NULL );
+        }
+#endif
+    if( mwLogModeSel == MW_LOG_THREAD ) mwLogModeSel = MW_LOG_DEFER;
+    }
+
+/* formats a diagnostic, optionally colored, and queues it */
+static void mwLog( const char *format, ... ) {
+    char buffer[MW_TRACE_BUFFER+16];
+    va_list mark;
+    int n, pre = 0;
+
+    if( mwLogColored ) {
+        memcpy( buffer, "\033[32m", 5 );
+        pre = 5;
+        }
+    va_start( mark, format );
+    n = vsnprintf( buffer+pre, MW_TRACE_BUFFER-pre, format, mark );
+    va_end( mark );
+    if( n < 0 ) return;
+    if( n > MW_TRACE_BUFFER-pre-1 ) n = MW_TRACE_BUFFER-pre-1;
+    n += pre;
+    if( mwLogColored ) {
+        memcpy( buffer+n, "\033[0m", 4 );
+        n += 4;
+        }
+    if( n == 0 || buffer[n-1] != '\n' ) buffer[n++] = '\n';
+    mwLogPut( buffer, (unsigned) n );
+    }
+
+/*
+** Queues 'len' bytes of text, splitting it over several slots if
+** needed. All the slots a message needs are taken at once, so that
+** messages from different threads don't interleave and a message is
+** never dropped halfway. Producers only contend on mwLogHead. When
+** the ring is full, the text is either dropped (and counted), or the
+** producer drains the ring itself, or waits for the thread that is
+** draining it.
+*/
+static void mwLogPut( const char *text, unsigned len ) {
+    unsigned long pos;
+    mwLogSlot *slot;
+    long dif;
+    unsigned k, n, i, j;
+
+    if( len > MW_LOG_SLOT * MW_LOG_SLOTS ) len = MW_LOG_SLOT * MW_LOG_SLOTS;
+    k = ( len + MW_LOG_SLOT - 1 ) / MW_LOG_SLOT;
+    if( k == 0 ) return;
+    pos = mwLogHead;
+    for(;;) {
+        /* slots are freed in order, so the last one being free will do */
+        i = (unsigned)( ( pos + k - 1 ) % MW_LOG_SLOTS );
+        dif = (long)( mwLogRing[i].seq + i - ( pos + k - 1 ) );
+        if( dif == 0 ) {
+            if( mwCAS( &mwLogHead, pos, pos+k ) ) break;
+            pos = mwLogHead;
+            }
+        else if( dif < 0 ) {
+            /* full */
+            if( mwLogPolicySel == MW_LOG_DROP ) {
+                mwATOMIC_ADD( &mwLogLostCount, 1 );
+                return;
                 }
-            mrk->level --;
-            return p;
+            if( !mwLogDrain() ) mwBARRIER();
+            pos = mwLogHead;
             }
-        prv = mrk;
-        mrk = mrk->next;
+        else pos = mwLogHead;
         }
-    mw_printf("mark: %s(%d), no mark found for %p\n", file, line, p );
-    return p;
+
+    for( j=0; j<k; j++, pos++ ) {
+        n = len > MW_LOG_SLOT ? MW_LOG_SLOT : len;
+        i = (unsigned)( pos % MW_LOG_SLOTS );
+        slot = &mwLogRing[i];
+        memcpy( slot->text, text, n );
+        slot->len = n;
+        mwBARRIER();
+        slot->seq = pos + 1 - i;
+        text += n;
+        len -= n;
+        }
+
+    if( mwLogModeSel == MW_LOG_SYNC ) (void) mwLogDrain();
+    }
+
+/*
+** Writes queued messages to the sink, in order.
+** Returns the number of messages written. Only one caller
+** drains at a time; others return zero immediately.
+*/
+static int mwLogDrain( void ) {
+    mwLogSlot *slot;
+    unsigned i;
+    int n = 0;
+    unsigned long lost;
+    char buffer[64];
+
+    if( !mwCAS( &mwLogBusy, 0, 1 ) ) return 0;
+    for(;;) {
+        i = (unsigned)( mwLogTail % MW_LOG_SLOTS );
+        slot = &mwLogRing[i];
+        if( slot->seq + i != mwLogTail + 1 ) break;
+        mwBARRIER();
+        mwLogWrite( slot->text, slot->len );
+        mwBARRIER();
+        slot->seq = mwLogTail + MW_LOG_SLOTS - i;
+        mwLogTail ++;
+        n ++;
+        }
+    lost = mwLogLostCount;
+    if( lost != mwLogLostTold ) {
+        sprintf( buffer, "log: %lu messages lost\n", lost - mwLogLostTold );
+        mwLogWrite( buffer, (unsigned) strlen( buffer ) );
+        mwLogLostTold = lost;
+        }
+    if( n && mwFlushing && mwOutFile != NULL ) fflush( mwOutFile );
+    mwBARRIER();
+    mwLogBusy = 0;
+    return n;
+    }
+
+/* hands text to the sink; only called while draining */
+static void mwLogWrite( const char *text, unsigned len ) {
+    unsigned i;
+
+    if( mwOutFunction != NULL ) {
+        for( i=0; i<len; i++ ) (*mwOutFunction)( (unsigned char) text[i] );
+        return;
+        }
+    if( mwOutSink != NULL ) {
+        (*mwOutSink)( text, len );
+        return;
+        }
+#ifdef MW_HAVE_UNISTD
+    if( mwOutFd != 1 && mwOutFd != 2 ) {
+        while( len ) {
+            long n = (long) write( mwOutFd, text, len );
+            if( n <= 0 ) return;
+            text += n;
+            len -= (unsigned) n;
+            }
+        return;
+        }
+#endif
+    mwOutFile = mwOutFd == 1 ? stdout : mwSTDERR;
+    (void) fwrite( text, 1, len, mwOutFile );
+    }
+
+/***********************************************************************
+** Event recording
+**
+** mwRecordOpen() starts a binary trace of allocation events, in the
+** format described in mwtrace.h. Each thread encodes its events into
+** its own buffer, which is written out as one chunk when it fills up.
+** Sites are written to the file directly the first time they're used.
+***********************************************************************/
+
+int mwRecordOpen( const char *path ) {
+    int ok = 0;
+    mwAutoInit();
+    MW_MUTEX_LOCK();
+    mwRecordClose();
+    mwRecFile = fopen( path, "wb" );
+    if( mwRecFile == NULL ) {
+        mw_printf( "record: can't open '%s'\n", path );
+        }
+    else if( fwrite( MWT_MAGIC, 1, 8, mwRecFile ) != 8 ) {
+        mw_printf( "record: can't write to '%s'\n", path );
+        fclose( mwRecFile );
+        mwRecFile = NULL;
+        }
+    else {
+        mwRecGen ++;
+        mw_printf( "record: <%ld> tracing events to '%s'\n", mwCounter, path );
+        ok = 1;
+        }
+    MW_MUTEX_UNLOCK();
+    return ok;
+    }
+
+void mwRecordClose( void ) {
+    mwRecBuf *rb;
+    unsigned char end[32], *o;
+
+    if( mwRecFile == NULL ) return;
+    MW_MUTEX_LOCK();
+    for( rb=mwRecBufs; rb; rb=rb->next ) mwRecFlush( rb );
+    if( mwRecFile == NULL ) {
+        MW_MUTEX_UNLOCK();
+        return;
+        }
+    o = end;
+    *o++ = MWT_END;
+    o = mwRecVar( o, mwCounter );
+    o = mwRecVar( o, mwClockNs() );
+    (void) fwrite( end, 1, (size_t)(o - end), mwRecFile );
+    if( fclose( mwRecFile ) ) mw_printf( "record: error closing trace\n" );
+    mwRecFile = NULL;
+    MW_MUTEX_UNLOCK();
+    }
+
+/*
+** Only events from allocations made in 'file' are recorded. A 'file'
+** matches if it is the tail end of the allocation's file name. If
+** 'line' is nonzero, it must match too. Allocation events are also
+** filtered on size; a 'maxsize' of zero means no upper limit.
+*/
+void mwRecordFilter( const char *file, int line, size_t minsize, size_t maxsize ) {
+    mwSite *site;
+    int i;
+    MW_MUTEX_LOCK();
+    mwRecOnly = file;
+    mwRecOnlyLine = line;
+    mwRecMin = minsize;
+    mwRecMax = maxsize;
+    for( i=0; i<MW_SITE_HASH; i++ )
+        for( site=mwSiteTable[i]; site; site=site->next )
+            site->skip = -1;
+    MW_MUTEX_UNLOCK();
+    }
+
+static unsigned char *mwRecVar( unsigned char *o, mwQWORD v ) {
+    while( v >= 0x80 ) {
+        *o++ = (unsigned char)( v | 0x80 );
+        v >>= 7;
+        }
+    *o++ = (unsigned char) v;
+    return o;
+    }
+
+/* zigzag encoding of the signed difference a-b */
+static unsigned char *mwRecZig( unsigned char *o, unsigned long a, unsigned long b ) {
+    if( a >= b ) return mwRecVar( o, (mwQWORD)( a - b ) << 1 );
+    return mwRecVar( o, (((mwQWORD)( b - a ) - 1) << 1) | 1 );
+    }
+
+#ifdef MW_HAVE_MUTEX
+/* thread exit; flush the thread's buffer and let another thread use it */
+static void mwRecRelease( void *arg ) {
+    mwRecBuf *rb = (mwRecBuf*) arg;
+    MW_MUTEX_LOCK();
+    if( mwRecFile ) mwRecFlush( rb );
+    rb->thread = 0;
+    MW_MUTEX_UNLOCK();
+    }
+#endif
+
+static mwRecBuf *mwRecBufGet( void ) {
+    mwRecBuf *rb;
+
+    if( mwRecMine != NULL ) return mwRecMine;
+    for( rb=mwRecBufs; rb; rb=rb->next )
+        if( rb->thread == 0 ) break;
+    if( rb == NULL ) {
+        rb = (mwRecBuf*) malloc( sizeof(mwRecBuf) );
+        if( rb == NULL ) return NULL;
+        rb->next = mwRecBufs;
+        mwRecBufs = rb;
+        }
+    rb->thread = mwThreadNum();
+    rb->len = 0;
+    rb->counter = 0;
+    rb->time = 0;
+    rb->addr = 0;
+#ifdef MW_HAVE_MUTEX
+    if( !mwRecKeyMade ) mwRecKeyMade = !pthread_key_create( &mwRecKey, mwRecRelease );
+    if( mwRecKeyMade ) pthread_setspecific( mwRecKey, rb );
+#endif
+    mwRecMine = rb;
+    return rb;
+    }
+
+static void mwRecFlush( mwRecBuf *rb ) {
+    unsigned char head[32], *o;
+
+    if( rb->len == 0 ) return;
+    /* once the trace has been dropped, buffers are just emptied */
+    if( mwRecFile != NULL ) {
+        o = head;
+        *o++ = MWT_CHUNK;
+        o = mwRecVar( o, rb->thread );
+        o = mwRecVar( o, rb->len );
+        if( fwrite( head, 1, (size_t)(o - head), mwRecFile ) != (size_t)(o - head) ||
+            fwrite( rb->data, 1, rb->len, mwRecFile ) != rb->len ) {
+            mw_printf( "record: write failed, trace stopped\n" );
+            fclose( mwRecFile );
+            mwRecFile = NULL;
+            }
+        }
+    rb->len = 0;
+    rb->counter = 0;
+    rb->time = 0;
+    rb->addr = 0;
+    }
+
+/* decides whether events for a site are recorded */
+static int mwRecSkip( mwSite *site ) {
+    size_t n, m;
+    if( mwRecOnly == NULL ) return 0;
+    if( mwRecOnlyLine && site->line != mwRecOnlyLine ) return 1;
+    if( site->file == NULL ) return 1;
+    n = strlen( site->file );
+    m = strlen( mwRecOnly );
+    return m > n || strcmp( site->file + n - m, mwRecOnly ) != 0;
+    }
+
+static void mwRecEvent( int type, mwSite *site, size_t size,
+    const void *p, const void *oldp, size_t oldsize, long age ) {
+    mwRecBuf *rb;
+    unsigned char *o;
+    mwQWORD now;
+    size_t n;
+
+    if( site->skip < 0 ) site->skip = mwRecSkip( site );
+    if( site->skip ) return;
+    if( type <= MWT_REALLOC &&
+        ( size < mwRecMin || ( mwRecMax && size > mwRecMax ) ) ) return;
+
+    /* new site for this file? */
+    if( site->gen != mwRecGen ) {
+        unsigned char head[32];
+        site->gen = mwRecGen;
+        n = site->file ? strlen( site->file ) : 0;
+        o = head;
+        *o++ = MWT_SITE;
+        o = mwRecVar( o, site->id );
+        o = mwRecVar( o, (mwQWORD)(long) site->line );
+        o = mwRecVar( o, n );
+        (void) fwrite( head, 1, (size_t)(o - head), mwRecFile );
+        if( n ) (void) fwrite( site->file, 1, n, mwRecFile );
+        }
+
+    rb = mwRecBufGet();
+    if( rb == NULL ) return;
+    if( rb->len > MW_REC_CHUNK - 80 ) {
+        mwRecFlush( rb );
+        if( mwRecFile == NULL ) return;
+        }
+
+    now = mwClockNs();
+    o = rb->data + rb->len;
+    *o++ = (unsigned char) type;
+    o = mwRecVar( o, mwCounter - rb->counter );
+    o = mwRecVar( o, now - rb->time );
+    o = mwRecVar( o, site->id );
+    o = mwRecVar( o, size );
+    o = mwRecZig( o, (unsigned long) p, rb->addr );
+    if( type == MWT_FREE ) o = mwRecVar( o, (mwQWORD) age );
+    if( type == MWT_REALLOC ) {
+        o = mwRecZig( o, (unsigned long) oldp, (unsigned long) p );
+        o = mwRecVar( o, oldsize );
+        }
+    rb->counter = mwCounter;
+    rb->time = now;
+    rb->addr = (unsigned long) p;
+    rb->len = (unsigned)( o - rb->data );
+    }
+
+/* passes an event on to the trace file and the flight recorder */
+static void mwEvent( int type, const char *file, int line, size_t size,
+    const void *p, const void *oldp, size_t oldsize, long age ) {
+    mwSite *site;
+
+    MW_MUTEX_LOCK();
+    site = mwSiteGet( file, line );
+    if( site != NULL ) {
+        if( mwRecFile ) mwRecEvent( type, site, size, p, oldp, oldsize, age );
+        if( mwFlight ) mwFlightEvent( type, site, size, p,
+            type == MWT_FREE ? (mwQWORD) age : (mwQWORD)(unsigned long) oldp );
+        }
+    MW_MUTEX_UNLOCK();
+    }
+
+/***********************************************************************
+** Flight recorder
+**
+** mwFlightOpen() keeps the latest events of each thread in rings in a
+** shared file mapping, so they survive a crash of the program. Events
+** are plain stores into memory that's already mapped and touched. The
+** layout is described in mwtrace.h; memwatch-flight decodes it.
+***********************************************************************/
+
+#define mwFLIGHTSITES(fh)   ((mwfSite*)((fh)+1))
+#define mwFLIGHTPOOL(fh)    ((char*)(mwFLIGHTSITES(fh)+(fh)->sites))
+#define mwFLIGHTRING(fh,i)  ((mwfRing*)((char*)(fh)+MWF_RINGS((fh)->sites,(fh)->pool)+(i)*MWF_RINGSIZE((fh)->events)))
+
+int mwFlightOpen( const char *path, long events ) {
+    mwfHeader *fh = NULL;
+    size_t base, size;
+
+    mwAutoInit();
+    MW_MUTEX_LOCK();
+    mwFlightClose();
+    if( events < 16 ) events = 16;
+    base = MWF_RINGS( MW_FLIGHT_SITES, MW_FLIGHT_POOL );
+    size = base + MW_FLIGHT_RINGS * MWF_RINGSIZE( events );
+
+#ifdef MW_HAVE_MMAP
+    if( path != NULL ) {
+        mwFlightFd = open( path, O_RDWR|O_CREAT|O_TRUNC, 0644 );
+        if( mwFlightFd >= 0 && ftruncate( mwFlightFd, (off_t) size ) == 0 ) {
+            fh = (mwfHeader*) mmap( NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, mwFlightFd, 0 );
+            if( fh == (mwfHeader*) MAP_FAILED ) fh = NULL;
+            }
+        if( fh == NULL ) {
+            mw_printf( "flight: can't map '%s', using memory only\n", path );
+            if( mwFlightFd >= 0 ) close( mwFlightFd );
+            mwFlightFd = -1;
+            }
+        }
+#endif
+
+#if MW_FLIGHT_STATIC > 0
+    /* in memory; found by memwatch-flight in a core dump */
+    if( fh == NULL && sizeof(mwFlightStatic) < base + MW_FLIGHT_RINGS * MWF_RINGSIZE( 16 ) )
+        mw_printf( "flight: MW_FLIGHT_STATIC is too small, it needs at least %ld bytes\n",
+            (long)( base + MW_FLIGHT_RINGS * MWF_RINGSIZE( 16 ) ) );
+    else if( fh == NULL ) {
+        if( size > sizeof(mwFlightStatic) ) {
+            events = (long)( ( ( sizeof(mwFlightStatic) - base ) / MW_FLIGHT_RINGS
+                - sizeof(mwfRing) ) / sizeof(mwfEvent) );
+            size = base + MW_FLIGHT_RINGS * MWF_RINGSIZE( events );
+            }
+        fh = (mwfHeader*) mwFlightStatic;
+        path = NULL;
+        }
+#endif
+
+    if( fh == NULL ) {
+        mw_printf( "flight: no flight recorder available\n" );
+        MW_MUTEX_UNLOCK();
+        return 0;
+        }
+
+    memset( fh, 0, size );
+    fh->size = (MWT_U32) size;
+    fh->rings = MW_FLIGHT_RINGS;
+    fh->events = (MWT_U32) events;
+    fh->sites = MW_FLIGHT_SITES;
+    fh->pool = MW_FLIGHT_POOL;
+    fh->counter = mwCounter;
+    fh->errors = (MWT_U32) mwErrors;
+    mwBARRIER();
+    memcpy( fh->magic, MWF_MAGIC, 8 );
+
+    mwFlightSize = size;
+    mwFlightGen ++;
+    mwFlight = fh;
+    mw_printf( "flight: <%ld> recording the last %ld events per thread %s%s\n",
+        mwCounter, events, path ? "to " : "in memory", path ? path : "" );
+    MW_MUTEX_UNLOCK();
+    return 1;
+    }
+
+void mwFlightClose( void ) {
+    if( mwFlight == NULL ) return;
+    MW_MUTEX_LOCK();
+    mwFlight->counter = mwCounter;
+    mwFlight->errors = (MWT_U32) mwErrors;
+#ifdef MW_HAVE_MMAP
+    if( mwFlightFd >= 0 ) {
+        munmap( (void*) mwFlight, mwFlightSize );
+        close( mwFlightFd );
+        mwFlightFd = -1;
+        }
+#endif
+    mwFlight = NULL;
+    MW_MUTEX_UNLOCK();
+    }
+
+/* threads past the last ring share it */
+static mwfRing* mwFlightRingGet( void ) {
+    mwfHeader *fh = mwFlight;
+    mwfRing *ring;
+
+    if( fh->ringsused < fh->rings ) {
+        ring = mwFLIGHTRING( fh, fh->ringsused );
+        ring->thread = mwThreadNum();
+        fh->ringsused ++;
+        }
+    else ring = mwFLIGHTRING( fh, fh->rings - 1 );
+    mwFlightMine = ring;
+    mwFlightMyGen = mwFlightGen;
+    return ring;
+    }
+
+static void mwFlightEvent( int type, mwSite *site, size_t size,
+    const void *p, mwQWORD aux ) {
+    mwfHeader *fh = mwFlight;
+    mwfRing *ring = mwFlightMine;
+    mwfEvent *ev;
+    mwfSite *fs;
+    size_t n;
+
+    if( ring == NULL || mwFlightMyGen != mwFlightGen ) ring = mwFlightRingGet();
+
+    if( site->fgen != mwFlightGen && site->id < fh->sites ) {
+        site->fgen = mwFlightGen;
+        fs = mwFLIGHTSITES( fh ) + site->id;
+        fs->line = (MWT_U32) site->line;
+        n = site->file ? strlen( site->file ) + 1 : 0;
+        if( n && fh->poolused + n <= fh->pool ) {
+            memcpy( mwFLIGHTPOOL( fh ) + fh->poolused, site->file, n );
+            fs->name = fh->poolused + 1;
+            fh->poolused += (MWT_U32) n;
+            }
+        }
+
+    ev = (mwfEvent*)( ring + 1 ) + (size_t)( ring->head % fh->events );
+    ev->counter = mwCounter;
+    ev->addr = (unsigned long) p;
+    ev->size = size;
+    ev->aux = aux;
+    ev->site = site->id < fh->sites ? site->id : 0;
+    ev->type = (MWT_U32) type;
+    mwBARRIER();
+    ring->head ++;
+    fh->counter = mwCounter;
+    fh->errors = (MWT_U32) mwErrors;
+    }
+
+/***********************************************************************
+** Call stacks
+**
+** With mwStacks() on, the call stack of every allocation is captured.
+** Stacks are kept once each in a hash-consed depot, and blocks refer
+** to them by a 32 bit id. Addresses are only turned into names when a
+** report is written.
+***********************************************************************/
+
+void mwStacks( int level ) {
+    mwAutoInit();
+#ifdef MW_HAVE_STACKS
+    if( level != mwStackLevel )
+        mw_printf( "stacks: <%ld> %s\n", mwCounter,
+            level < MW_STACK_ALLOC ? "off" :
+            level < MW_STACK_FREE ? "captured on allocation" : "captured on allocation and free" );
+    mwStackLevel = level;
+#else
+    if( level ) mw_printf( "stacks: not available on this system\n" );
+#endif
+    }
+
+int mwOwned( void *p, size_t *size ) {
+    mwData *mw;
+    if( p == NULL || mwDataSize == 0 ) return 0;
+    mw = mwBUFFER_TO_MW( p );
+#ifdef MW_PTRHASH
+    if( !mwPtrFind( mw ) ) return 0;
+#else
+    if( !mwIsReadAddr( mw, (unsigned) mwDataSize ) || mw->check != CHKVAL(mw) ) return 0;
+#endif
+    if( size ) *size = mw->size;
+    return 1;
+    }
+
+unsigned mwStackId( void *p ) {
+    unsigned id = 0;
+    mwData *mw;
+    mwAutoInit();
+    if( p == NULL ) return 0;
+    MW_MUTEX_LOCK();
+    mw = mwBUFFER_TO_MW( p );
+    if( mwIsOwned( mw, __FILE__, __LINE__ ) ) id = mw->stack;
+    MW_MUTEX_UNLOCK();
+    return id;
+    }
+
+int mwStackFrames( unsigned id, void **pc, int max ) {
+    mwStack *st;
+    int n = 0;
+    MW_MUTEX_LOCK();
+    if( id > 0 && id <= mwStackCount ) {
+        st = mwStackById[id];
+        for( n=0; n<st->depth && n<max; n++ ) pc[n] = st->pc[n];
+        }
+    MW_MUTEX_UNLOCK();
+    return n;
+    }
+
+/*
+** Returns the depot id of the calling stack, leaving out this function
+** and the 'skip' callers above it.
+*/
+static MW_NOINLINE unsigned mwStackCapture( int skip ) {
+    void *pc[MW_STACK_DEPTH+8];
+    int n = 0;
+#if defined(MW_STACK_FP) && defined(__GNUC__)
+    void **fp = (void**) __builtin_frame_address( 0 ), **up;
+
+    /* assumes every frame saves the caller's frame pointer and return address */
+    while( fp != NULL && n < MW_STACK_DEPTH + skip && n < MW_STACK_DEPTH + 8 ) {
+        if( fp[1] == NULL ) break;
+        pc[n++] = fp[1];
+        up = (void**) fp[0];
+        if( up <= fp || (char*) up - (char*) fp > MW_STACK_SPAN ||
+            ( (unsigned long) up & ( sizeof(void*) - 1 ) ) ) break;
+        fp = up;
+        }
+#elif defined(MW_HAVE_BACKTRACE)
+    if( skip > 7 ) skip = 7;
+    n = backtrace( pc, MW_STACK_DEPTH + skip + 1 );
+    if( n > 0 ) memmove( pc, pc + 1, --n * sizeof(void*) );
+#endif
+    if( n <= skip ) return 0;
+    n -= skip;
+    return mwStackIntern( pc + skip, n > MW_STACK_DEPTH ? MW_STACK_DEPTH : n );
+    }
+
+static unsigned mwStackIntern( void **pc, int depth ) {
+    mwStack *st, **grown;
+    unsigned long h = 2166136261UL;
+    unsigned id;
+    int i;
+
+    for( i=0; i<depth; i++ ) h = ( h ^ (unsigned long) pc[i] ) * 16777619UL;
+    h ^= h >> 15;
+
+    MW_MUTEX_LOCK();
+    for( st=mwStackTable[h & (MW_STACK_HASH-1)]; st; st=st->next ) {
+        if( st->hash == (unsigned) h && st->depth == depth &&
+            !memcmp( st->pc, pc, depth * sizeof(void*) ) ) {
+            id = st->id;
+            MW_MUTEX_UNLOCK();
+            return id;
+            }
+        }
+
+    if( mwStackCount + 1 >= mwStackMax ) {
+        grown = (mwStack**) realloc( mwStackById,
+            ( mwStackMax ? mwStackMax * 2 : 256 ) * sizeof(mwStack*) );
+        if( grown == NULL ) { MW_MUTEX_UNLOCK(); return 0; }
+        mwStackById = grown;
+        mwStackMax = mwStackMax ? mwStackMax * 2 : 256;
+        }
+    st = (mwStack*) malloc( sizeof(mwStack) + ( depth - 1 ) * sizeof(void*) );
+    if( st == NULL ) { MW_MUTEX_UNLOCK(); return 0; }
+    st->hash = (unsigned) h;
+    st->depth = depth;
+    st->num = st->total = st->curnum = st->curr = 0;
+    memcpy( st->pc, pc, depth * sizeof(void*) );
+    st->id = id = ++ mwStackCount;
+    mwStackById[id] = st;
+    st->next = mwStackTable[h & (MW_STACK_HASH-1)];
+    mwStackTable[h & (MW_STACK_HASH-1)] = st;
+    MW_MUTEX_UNLOCK();
+    return id;
+    }
+
+/* a positive size is an allocation, a negative one a free */
+static void mwStackAdd( unsigned id, long size ) {
+    mwStack *st;
+    if( id == 0 || id > mwStackCount ) return;
+    st = mwStackById[id];
+    if( size >= 0 ) {
+        st->num ++;
+        st->total += size;
+        st->curnum ++;
+        }
+    else st->curnum --;
+    st->curr += size;
+    }
+
+static void mwStackPrint( unsigned id ) {
+    mwStack *st;
+    char **names = NULL;
+    int i;
+
+    if( id == 0 || id > mwStackCount ) return;
+    st = mwStackById[id];
+#ifdef MW_HAVE_BACKTRACE
+    names = backtrace_symbols( st->pc, st->depth );
+#endif
+    for( i=0; i<st->depth; i++ ) {
+        if( names ) mw_printf( "    #%-2d %s\n", i, names[i] );
+        else mw_printf( "    #%-2d %p\n", i, st->pc[i] );
+        }
+    free( names );
+    }
+
+static int mwStackByCurr( const void *a, const void *b ) {
+    long x = (*(mwStack* const*) a)->curr, y = (*(mwStack* const*) b)->curr;
+    return x > y ? -1 : x < y;
+    }
+
+static int mwStackByTotal( const void *a, const void *b ) {
+    long x = (*(mwStack* const*) a)->total, y = (*(mwStack* const*) b)->total;
+    return x > y ? -1 : x < y;
+    }
+
+static void mwStackReport( void ) {
+    mwStack **list;
+    unsigned i;
+
+    if( mwStackCount == 0 ) return;
+    list = (mwStack**) malloc( mwStackCount * sizeof(mwStack*) );
+    if( list == NULL ) return;
+    memcpy( list, mwStackById + 1, mwStackCount * sizeof(mwStack*) );
+
+    qsort( list, mwStackCount, sizeof(mwStack*), mwStackByCurr );
+    if( list[0]->curnum > 0 ) {
+        mw_printf( "\nUnfreed memory by stack:\n" );
+        for( i=0; i<mwStackCount && i<MW_STACK_TOP && list[i]->curnum > 0; i++ ) {
+            mw_printf( " stack #%u: %ld blocks, %ld bytes\n",
+                list[i]->id, list[i]->curnum, list[i]->curr );
+            mwStackPrint( list[i]->id );
+            }
+        }
+
+    qsort( list, mwStackCount, sizeof(mwStack*), mwStackByTotal );
+    mw_printf( "\nMemory usage statistics (by stack):\n" );
+    for( i=0; i<mwStackCount && i<MW_STACK_TOP && list[i]->num > 0; i++ ) {
+        mw_printf( " stack #%u: %ld allocations, %ld bytes total, %ld unfreed\n",
+            list[i]->id, list[i]->num, list[i]->total, list[i]->curr );
+        mwStackPrint( list[i]->id );
+        }
+    free( list );
+    }
+
+static void mwStackFree( void ) {
+    unsigned i;
+    for( i=1; i<=mwStackCount; i++ ) free( mwStackById[i] );
+    free( mwStackById );
+    mwStackById = NULL;
+    mwStackCount = mwStackMax = 0;
+    memset( mwStackTable, 0, sizeof(mwStackTable) );
+    memset( mwLFstack, 0, sizeof(mwLFstack) );
+    }
+
+/***********************************************************************
+** Heap snapshots
+**
+** The lock is only held while the file, line, size and counter of the
+** live blocks are copied out; from the block table with memcpy() if it
+** is in use, else from the chain. Sorting and summing by site is done
+** after unlocking.
+***********************************************************************/
+
+mwSnap* mwSnapshot( void ) {
+    mwSnap *snap;
+    mwData *mw;
+    mwSnapSite *ss, *tmp;
+    void *buf = NULL;
+    long have = 0, n = 0, i, k;
+    const char **files;
+    int *lines;
+    size_t *sizes;
+    long *counts;
+    unsigned *flags;
+
+    mwAutoInit();
+
+    /* size the copy outside the lock, and try again if the heap grew */
+    for(;;) {
+        MW_MUTEX_LOCK();
+        n = mwNumCurAlloc + mwNmlNumAlloc;
+        if( n <= have ) break;
+        MW_MUTEX_UNLOCK();
+        free( buf );
+        have = n + n / 8 + 64;
+        buf = malloc( have * ( sizeof(char*) + sizeof(size_t) + sizeof(long) + sizeof(int) + sizeof(unsigned) ) );
+        if( buf == NULL ) return NULL;
+        }
+    files = (const char**) buf;
+    sizes = (size_t*)( files + have );
+    counts = (long*)( sizes + have );
+    lines = (int*)( counts + have );
+    flags = (unsigned*)( lines + have );
+
+    if( mwOOL ) {
+        n = mwTabUsed < have ? mwTabUsed : have;
+        memcpy( files, mwTabFile, n * sizeof(char*) );
+        memcpy( sizes, mwTabSize, n * sizeof(size_t) );
+        memcpy( counts, mwTabCount, n * sizeof(long) );
+        memcpy( lines, mwTabLine, n * sizeof(int) );
+        memcpy( flags, mwTabFlag, n * sizeof(unsigned) );
+        }
+    else {
+        for( n=0, mw=mwHead; mw && n<have; mw=mw->next, n++ ) {
+            files[n] = mw->file;
+            sizes[n] = mw->size;
+            counts[n] = mw->count;
+            lines[n] = mw->line;
+            flags[n] = mw->flag;
+            }
+        }
+    k = mwCounter;
+    MW_MUTEX_UNLOCK();
+
+    /* one site entry per block, then sort and merge them */
+    tmp = (mwSnapSite*) malloc( ( n + 1 ) * sizeof(mwSnapSite) );
+    if( tmp == NULL ) { free( buf ); return NULL; }
+    for( i=0, ss=tmp; i<n; i++ ) {
+        if( flags[i] & MW_NML ) continue;
+        ss->file = files[i];
+        ss->line = lines[i];
+        ss->num = 1;
+        ss->bytes = (long) sizes[i];
+        ss->first = ss->last = counts[i];
+        ss ++;
+        }
+    free( buf );
+    n = (long)( ss - tmp );
+    qsort( tmp, n, sizeof(mwSnapSite), mwSnapCmp );
+
+    snap = (mwSnap*) malloc( sizeof(mwSnap) + n * sizeof(mwSnapSite) );
+    if( snap == NULL ) { free( tmp ); return NULL; }
+    snap->counter = k;
+    snap->num = snap->bytes = snap->sites = 0;
+    for( i=0; i<n; i++ ) {
+        snap->num ++;
+        snap->bytes += tmp[i].bytes;
+        ss = snap->site + snap->sites - 1;
+        if( snap->sites && !mwSnapCmp( ss, tmp + i ) ) {
+            ss->num ++;
+            ss->bytes += tmp[i].bytes;
+            if( tmp[i].first < ss->first ) ss->first = tmp[i].first;
+            if( tmp[i].last > ss->last ) ss->last = tmp[i].last;
+            }
+        else snap->site[snap->sites++] = tmp[i];
+        }
+    free( tmp );
+    return snap;
+    }
+
+int mwSnapshotDiff( const mwSnap *a, const mwSnap *b ) {
+    const mwSnapSite *sa, *ea, *sb;
+    mwSnapGrowth *grew, *g;
+    long i, found;
+    int c;
+
+    if( a == NULL || b == NULL ) return 0;
+    grew = (mwSnapGrowth*) malloc( ( b->sites + 1 ) * sizeof(mwSnapGrowth) );
+    if( grew == NULL ) return 0;
+
+    /* both are sorted by site, so walk them side by side */
+    sa = a->site;
+    ea = sa + a->sites;
+    for( g=grew, i=0; i<b->sites; i++ ) {
+        sb = b->site + i;
+        while( sa < ea && mwSnapCmp( sa, sb ) < 0 ) sa ++;
+        c = sa < ea ? mwSnapCmp( sa, sb ) : 1;
+        g->now = sb;
+        g->bytes = sb->bytes - ( c ? 0 : sa->bytes );
+        g->num = sb->num - ( c ? 0 : sa->num );
+        if( g->bytes > 0 || g->num > 0 ) g ++;
+        }
+    found = (long)( g - grew );
+    qsort( grew, found, sizeof(mwSnapGrowth), mwSnapByGrowth );
+
+    mw_printf( "\nSnapshot diff <%ld> to <%ld>: %+ld bytes in %+ld blocks\n",
+        a->counter, b->counter, b->bytes - a->bytes, b->num - a->num );
+    for( g=grew; g<grew+found; g++ ) {
+        sb = g->now;
+        mw_printf( " %s(%d): %+ld bytes in %+ld blocks, now %ld bytes in %ld blocks <%ld>-<%ld>\n",
+            sb->file, sb->line, g->bytes, g->num, sb->bytes, sb->num, sb->first, sb->last );
+        }
+    free( grew );
+    return (int) found;
+    }
+
+void mwSnapshotFree( mwSnap *snap ) {
+    free( snap );
+    }
+
+static int mwSnapCmp( const void *a, const void *b ) {
+    const mwSnapSite *x = (const mwSnapSite*) a, *y = (const mwSnapSite*) b;
+    int c;
+    if( x->file != y->file ) {
+        if( x->file == NULL || y->file == NULL ) return x->file == NULL ? -1 : 1;
+        if( ( c = strcmp( x->file, y->file ) ) != 0 ) return c;
+        }
+    return x->line < y->line ? -1 : x->line > y->line;
+    }
+
+static int mwSnapByGrowth( const void *a, const void *b ) {
+    const mwSnapGrowth *x = (const mwSnapGrowth*) a, *y = (const mwSnapGrowth*) b;
+    if( x->bytes != y->bytes ) return x->bytes > y->bytes ? -1 : 1;
+    return x->num > y->num ? -1 : x->num < y->num;
+    }
+
+/***********************************************************************
+** Block lifetimes
+**
+** With mwLifetimes() on, each block gets a timestamp when allocated.
+** When it's freed, its age in operations (mwCounter) and nanoseconds
+** is counted in its site's histograms. Blocks allocated while off
+** have no timestamp and are left out.
+***********************************************************************/
+
+void mwLifetimes( int onoff ) {
+    mwAutoInit();
+    MW_MUTEX_LOCK();
+    if( onoff != mwLifeOn )
+        mw_printf( "lifetimes: <%ld> %s\n", mwCounter, onoff ? "tracking" : "not tracking" );
+    mwLifeOn = onoff;
+    MW_MUTEX_UNLOCK();
+    }
+
+static mwLife* mwLifeGet( const char *file, int line ) {
+    mwSite *site = mwSiteGet( file, line );
+    if( site == NULL ) return NULL;
+    if( site->life == NULL )
+        site->life = (mwLife*) calloc( 1, sizeof(mwLife) );
+    return site->life;
+    }
+
+/* the number of bits in 'v', so class n holds 2^(n-1) to 2^n-1 */
+static int mwLifeClass( mwQWORD v ) {
+    int n = 0;
+    if( v == 0 ) return 0;
+#if defined(__GNUC__)
+    n = (int)( sizeof(unsigned long long) * 8 ) - __builtin_clzll( (unsigned long long) v );
+#else
+    while( v ) { v >>= 1; n ++; }
+#endif
+    return n < mwLIFECLASSES ? n : mwLIFECLASSES - 1;
+    }
+
+/* the top of the class the median falls in */
+static mwQWORD mwLifeMedian( const long *hist, long n ) {
+    long seen = 0;
+    int i;
+    for( i=0; i<mwLIFECLASSES; i++ ) {
+        seen += hist[i];
+        if( seen * 2 >= n ) break;
+        }
+    if( i == 0 ) return 0;
+    if( i >= (int)( sizeof(mwQWORD) * 8 ) ) return ~(mwQWORD) 0;
+    return ( (mwQWORD) 1 << i ) - 1;
+    }
+
+static int mwLifeByAllocs( const void *a, const void *b ) {
+    long x = (*(mwSite* const*) a)->life->allocs, y = (*(mwSite* const*) b)->life->allocs;
+    return x > y ? -1 : x < y;
+    }
+
+static int mwLifeWanted( mwSite *site ) {
+    return site->life && site->life->allocs;
+    }
+
+static void mwLifeReport( void ) {
+    mwSite *site, **list;
+    mwQWORD ops, ns;
+    long n, i, live;
+    const char *kind;
+    char buf[64];
+
+    list = mwSiteList( mwLifeWanted, mwLifeByAllocs, &n );
+    if( list == NULL ) return;
+
+    /*
+    ** Short-lived blocks could come from an arena or the stack instead.
+    ** Sites whose blocks mostly outlive the program count as long-lived.
+    */
+    mw_printf( "\nBlock lifetimes (by site):\n" );
+    mw_printf( " Module/Line                                Blocks   Unfreed  Median ops   Median time  Class\n" );
+    for( i=0; i<n; i++ ) {
+        site = list[i];
+        live = site->life->allocs - site->life->frees;
+        ops = mwLifeMedian( site->life->ops, site->life->frees );
+        ns = mwLifeMedian( site->life->ns, site->life->frees );
+        if( live * 2 > site->life->allocs || ops >= MW_LIFE_LONG ) kind = "long";
+        else if( ops < MW_LIFE_SHORT ) kind = "short";
+        else kind = "medium";
+
+        mwSiteName( buf, site->file, site->line );
+        if( site->life->frees == 0 )
+            mw_printf( " %-42s %-8ld %-8ld -            -            %s\n",
+                buf, site->life->allocs, live, kind );
+        else if( ns >= 10000000UL )
+            mw_printf( " %-42s %-8ld %-8ld %-12lu %-9lu ms %s\n",
+                buf, site->life->allocs, live, (unsigned long) ops, (unsigned long)( ns / 1000000UL ), kind );
+        else
+            mw_printf( " %-42s %-8ld %-8ld %-12lu %-9lu us %s\n",
+                buf, site->life->allocs, live, (unsigned long) ops, (unsigned long)( ns / 1000UL ), kind );
+        }
+    free( list );
+    }
+
+/***********************************************************************
+** Realloc chains
+**
+** A buffer that realloc() moves keeps a count of its moves, and each
+** realloc() is counted at its site. When the buffer is finally freed,
+** its move count and final size are counted at the site of its last
+** realloc(). Buffers still allocated at the end are not included.
+***********************************************************************/
+
+static mwGrow* mwGrowGet( const char *file, int line ) {
+    mwSite *site = mwSiteGet( file, line );
+    if( site == NULL ) return NULL;
+    if( site->grow == NULL )
+        site->grow = (mwGrow*) calloc( 1, sizeof(mwGrow) );
+    return site->grow;
+    }
+
+static void mwGrowAdd( mwData *from, mwData *to, const char *file, int line ) {
+    mwGrow *grow;
+    long copied = (long)( from->size < to->size ? from->size : to->size );
+
+    mwStatNumRealloc ++;
+    mwStatCopied += copied;
+    to->moves = from->moves + 1;
+    /* the old block ends no chain */
+    from->moves = 0;
+
+    grow = mwGrowGet( file, line );
+    if( grow == NULL ) return;
+    grow->reallocs ++;
+    grow->copied += copied;
+    if( to->size > from->size ) {
+        grow->grows ++;
+        if( ( to->size - from->size ) * 8 < from->size ) grow->tiny ++;
+        if( from->size ) grow->ratio += (long)( to->size * 1000 / from->size );
+        }
+    }
+
+static int mwGrowByCopied( const void *a, const void *b ) {
+    long x = (*(mwSite* const*) a)->grow->copied, y = (*(mwSite* const*) b)->grow->copied;
+    return x > y ? -1 : x < y;
+    }
+
+static int mwGrowWanted( mwSite *site ) {
+    return site->grow != NULL;
+    }
+
+static void mwGrowReport( void ) {
+    mwSite **list;
+    mwGrow *g;
+    unsigned long pct[3];
+    long n, i, ratio;
+    char buf[64];
+
+    list = mwSiteList( mwGrowWanted, mwGrowByCopied, &n );
+    if( list == NULL ) return;
+
+    mw_printf( "\nRealloc growth (by site):\n" );
+    mw_printf( " Module/Line                                Reallocs Copied   Growth  Moves/buffer\n" );
+    for( i=0; i<n; i++ ) {
+        g = list[i]->grow;
+        mwSiteName( buf, list[i]->file, list[i]->line );
+        ratio = g->grows ? g->ratio / g->grows : 1000;
+        if( g->chains )
+            mw_printf( " %-42s %-8ld %-8ld x%ld.%02ld   %ld.%ld (max %ld)\n", buf, g->reallocs, g->copied,
+                ratio / 1000, ratio % 1000 / 10, g->moves / g->chains, g->moves * 10 / g->chains % 10, g->longest );
+        else
+            mw_printf( " %-42s %-8ld %-8ld x%ld.%02ld   -\n", buf, g->reallocs, g->copied,
+                ratio / 1000, ratio % 1000 / 10 );
+
+        /* small steps copy the buffer over and over; better to pre-size */
+        if( mwHistPct( g->final, pct ) )
+            mw_printf( "  final size median %lu, 90%% %lu, 99%% %lu\n", pct[0], pct[1], pct[2] );
+        if( g->grows >= 4 && g->tiny * 2 > g->grows ) {
+            if( g->chains )
+                mw_printf( "  grows in small steps (%ld of %ld); allocate %lu up front or grow geometrically\n",
+                    g->tiny, g->grows, pct[1] );
+            else
+                mw_printf( "  grows in small steps (%ld of %ld); grow geometrically\n", g->tiny, g->grows );
+            }
+        }
+    free( list );
+    }
+
+/***********************************************************************
+** Churn
+**
+** With mwChurn() on, each site counts its allocations and frees, how
+** many blocks it has live at once and how often it asks for the same
+** size. Sites that churn through many small blocks of one size are
+** listed as candidates for a pool or free list.
+***********************************************************************/
+
+void mwChurn( int onoff ) {
+    mwAutoInit();
+    MW_MUTEX_LOCK();
+    if( onoff != mwChurnOn ) {
+        mw_printf( "churn: <%ld> %s\n", mwCounter, onoff ? "tracking" : "not tracking" );
+        if( onoff ) mwChurnSince = mwCounter;
+        }
+    mwChurnOn = onoff;
+    MW_MUTEX_UNLOCK();
+    }
+
+static mwChurnSite* mwChurnGet( const char *file, int line ) {
+    mwSite *site = mwSiteGet( file, line );
+    if( site == NULL ) return NULL;
+    if( site->churn == NULL )
+        site->churn = (mwChurnSite*) calloc( 1, sizeof(mwChurnSite) );
+    return site->churn;
+    }
+
+/*
+** A pool sized for the most blocks ever live saves every malloc() and
+** free() past the first 'maxlive', and the allocator's per-block
+** overhead, estimated here as one size_t rounded to two, on each.
+*/
+static long mwChurnSaved( const mwChurnSite *c ) {
+    return c->frees > c->maxlive ? 2 * ( c->frees - c->maxlive ) : 0;
+    }
+
+static long mwChurnBytes( const mwChurnSite *c ) {
+    size_t align = 2 * sizeof(size_t), chunk;
+    chunk = ( c->size + sizeof(size_t) + align - 1 ) / align * align;
+    if( chunk < 2 * align ) chunk = 2 * align;
+    return (long)( chunk - c->size ) * c->maxlive;
+    }
+
+static int mwChurnBySaved( const void *a, const void *b ) {
+    long x = mwChurnSaved( (*(mwSite* const*) a)->churn ), y = mwChurnSaved( (*(mwSite* const*) b)->churn );
+    return x > y ? -1 : x < y;
+    }
+
+/* small blocks of one size, freed often */
+static int mwChurnWanted( mwSite *site ) {
+    mwChurnSite *c = site->churn;
+    return c != NULL && c->frees >= MW_CHURN_MIN &&
+        c->size <= MW_CHURN_SIZE && c->same * 10 >= c->allocs * 9;
+    }
+
+static void mwChurnReport( void ) {
+    mwSite **list;
+    mwChurnSite *c;
+    long n, i, ops;
+    char buf[64];
+
+    list = mwSiteList( mwChurnWanted, mwChurnBySaved, &n );
+    if( list == NULL ) return;
+
+    ops = mwCounter - mwChurnSince;
+    if( ops < 1 ) ops = 1;
+    mw_printf( "\nPooling candidates (by site):\n" );
+    mw_printf( " Module/Line                                Size     Same%%  Per 1000 ops  Live avg/max  Calls saved  Bytes saved\n" );
+    for( i=0; i<n && i<MW_CHURN_TOP; i++ ) {
+        c = list[i]->churn;
+        mwSiteName( buf, list[i]->file, list[i]->line );
+        mw_printf( " %-42s %-8lu %-6ld %-13ld %6ld/%-6ld %-12ld %ld\n", buf,
+            (unsigned long) c->size, c->same * 100 / c->allocs, c->allocs * 1000 / ops,
+            c->livesum / c->allocs, c->maxlive, mwChurnSaved( c ), mwChurnBytes( c ) );
+        }
+    free( list );
+    }
+
+/***********************************************************************
+** Peak usage
+**
+** A new peak is only known to be over when the next block is freed,
+** so that's when the heap is broken down by site. To keep steady
+** growth cheap, a peak less than 1/MW_PEAK_STEP above the last one
+** captured is skipped, so the breakdown kept can be that far below
+** the true peak.
+***********************************************************************/
+
+void mwPeaks( int onoff ) {
+    mwAutoInit();
+    MW_MUTEX_LOCK();
+    mwPeakOn = onoff;
+    if( !onoff ) mwPeakDirty = 0;
+    MW_MUTEX_UNLOCK();
+    }
+
+long mwPeakSite( int n, const char **file, int *line, long *blocks ) {
+    long bytes = -1L;
+    mwAutoInit();
+    MW_MUTEX_LOCK();
+    if( mwPeakDirty ) mwPeakCapture();
+    if( n >= 0 && n < mwPeakUsed ) {
+        if( file ) *file = mwPeakTop[n].file;
+        if( line ) *line = mwPeakTop[n].line;
+        if( blocks ) *blocks = mwPeakTop[n].blocks;
+        bytes = mwPeakTop[n].bytes;
+        }
+    MW_MUTEX_UNLOCK();
+    return bytes;
+    }
+
+static int mwPeakBySize( const void *a, const void *b ) {
+    long x = (*(mwSite* const*) a)->peakbytes, y = (*(mwSite* const*) b)->peakbytes;
+    return x > y ? -1 : x < y;
+    }
+
+static int mwPeakWanted( mwSite *site ) {
+    return site->peakgen == mwPeakGen;
+    }
+
+static void mwPeakCapture( void ) {
+    mwSite *site, **list;
+    mwData *mw;
+    long n;
+
+    mwPeakDirty = 0;
+    if( mwPeakBytes && mwStatCurAlloc - mwPeakBytes < mwPeakBytes / MW_PEAK_STEP ) return;
+
+    /* sum the live blocks into their sites */
+    if( ++ mwPeakGen == 0 ) mwPeakGen = 1;
+    for( mw=mwHead; mw; mw=mw->next ) {
+        if( mw->flag & MW_NML ) continue;
+        site = mwSiteGet( mw->file, mw->line );
+        if( site == NULL ) continue;
+        if( site->peakgen != mwPeakGen ) {
+            site->peakgen = mwPeakGen;
+            site->peakbytes = site->peakblocks = 0;
+            }
+        site->peakbytes += (long) mw->size;
+        site->peakblocks ++;
+        }
+
+    list = mwSiteList( mwPeakWanted, mwPeakBySize, &n );
+    if( list == NULL && n ) return;
+
+    mwPeakBytes = mwStatCurAlloc;
+    mwPeakBlocks = mwNumCurAlloc;
+    mwPeakCounter = mwCounter;
+    for( mwPeakUsed=0; mwPeakUsed<n && mwPeakUsed<MW_PEAK_SITES; mwPeakUsed++ ) {
+        mwPeakTop[mwPeakUsed].file = list[mwPeakUsed]->file;
+        mwPeakTop[mwPeakUsed].line = list[mwPeakUsed]->line;
+        mwPeakTop[mwPeakUsed].bytes = list[mwPeakUsed]->peakbytes;
+        mwPeakTop[mwPeakUsed].blocks = list[mwPeakUsed]->peakblocks;
+        }
+    free( list );
+    }
+
+static void mwPeakReport( void ) {
+    char buf[64];
+    long i, rest;
+
+    if( mwPeakUsed == 0 ) return;
+    mw_printf( "\nMemory at peak (<%ld>, %ld bytes in %ld blocks):\n",
+        mwPeakCounter, mwPeakBytes, mwPeakBlocks );
+    mw_printf( " Module/Line                                Bytes      Blocks   Share\n" );
+    for( i=0, rest=mwPeakBytes; i<mwPeakUsed; i++ ) {
+        mwSiteName( buf, mwPeakTop[i].file, mwPeakTop[i].line );
+        mw_printf( " %-42s %-10ld %-8ld %ld%%\n", buf, mwPeakTop[i].bytes, mwPeakTop[i].blocks,
+            mwPeakBytes ? mwPeakTop[i].bytes * 100 / mwPeakBytes : 0L );
+        rest -= mwPeakTop[i].bytes;
+        }
+    if( rest > 0 )
+        mw_printf( " %-42s %-10ld\n", "(other sites)", rest );
+    }
+
+/***********************************************************************
+** Usage timeline
+**
+** Samples of heap usage are kept in a fixed array. When it fills up,
+** each pair of samples is merged into the larger one and the interval
+** doubles, as massif does, so a long run fits in the same space.
+***********************************************************************/
+
+void mwTimeline( long ops, long ms ) {
+    mwAutoInit();
+    MW_MUTEX_LOCK();
+    if( ops <= 0 && ms <= 0 ) {
+        mwTimeOn = 0;
+        mwSiteLive = mwLeakOn;
+        MW_MUTEX_UNLOCK();
+        return;
+        }
+    if( mwTime == NULL ) {
+        mwTime = (mwTimePoint*) malloc( MW_TIMELINE_SAMPLES * sizeof(mwTimePoint) );
+        if( mwTime == NULL ) {
+            mw_printf( "internal: memory low, no timeline\n" );
+            MW_MUTEX_UNLOCK();
+            return;
+            }
+        }
+    mwTimeUsed = 0;
+    mwTimeOps = ops > 0 ? ops : 0;
+    mwTimeNs = ms > 0 ? (mwQWORD) ms * 1000000UL : 0;
+    mwTimeStart = mwClockNs();
+    mwTimeNext = mwCounter;
+    mwTimeNsNext = 0;
+    mwSiteLive = mwTimeOn = 1;
+    mwTimeSample();
+    MW_MUTEX_UNLOCK();
+    }
+
+static void mwTimeSample( void ) {
+    mwTimePoint *tp;
+    mwSite *site;
+    mwQWORD now = 0;
+    int i, j;
+
+    /* the clock is only read every 64 operations */
+    if( !( mwTimeOps && mwCounter >= mwTimeNext ) ) {
+        if( !mwTimeNs || ( mwCounter & 63 ) ) return;
+        now = mwClockNs() - mwTimeStart;
+        if( now < mwTimeNsNext ) return;
+        }
+    if( now == 0 ) now = mwClockNs() - mwTimeStart;
+
+    if( mwTimeUsed == MW_TIMELINE_SAMPLES ) {
+        for( i=0; i<MW_TIMELINE_SAMPLES/2; i++ )
+            mwTime[i] = mwTime[2*i+1].bytes > mwTime[2*i].bytes ? mwTime[2*i+1] : mwTime[2*i];
+        mwTimeUsed = MW_TIMELINE_SAMPLES/2;
+        mwTimeOps *= 2;
+        mwTimeNs *= 2;
+        }
+    mwTimeNext = mwCounter + mwTimeOps;
+    mwTimeNsNext = now + mwTimeNs;
+
+    tp = mwTime + mwTimeUsed ++;
+    tp->counter = mwCounter;
+    tp->ns = now;
+    tp->bytes = mwStatCurAlloc;
+    tp->blocks = mwNumCurAlloc;
+    tp->nml = mwNmlCurAlloc;
+    tp->overhead = mwNumCurAlloc * (long)( mwDataSize + mwOverflowZoneSize*2 ) + mwNmlCurAlloc;
+    /* reading these walks the allocator and /proc, so not every time; -1 if not read */
+    if( tp > mwTime && ++mwTimeProc < MW_TIMELINE_PROC ) {
+        tp->heap = -1;
+        tp->rss = -1;
+        }
+    else {
+        mwTimeProc = 0;
+        tp->heap = mwHeapSize( NULL );
+        tp->rss = mwProcRss( 0, NULL );
+        }
+    tp->sites = 0;
+
+    /* keep the largest sites, by insertion */
+    for( i=0; i<MW_SITE_HASH; i++ ) {
+        for( site=mwSiteTable[i]; site; site=site->next ) {
+            if( site->livebytes <= 0 ) continue;
+            if( tp->sites == MW_TIMELINE_TOP && site->livebytes <= tp->site[tp->sites-1].bytes ) continue;
+            j = tp->sites < MW_TIMELINE_TOP ? tp->sites ++ : tp->sites - 1;
+            for( ; j>0 && tp->site[j-1].bytes < site->livebytes; j-- ) tp->site[j] = tp->site[j-1];
+            tp->site[j].file = site->file;
+            tp->site[j].line = site->line;
+            tp->site[j].bytes = site->livebytes;
+            tp->site[j].blocks = site->liveblocks;
+            }
+        }
+    }
+
+static void mwTimeLine( FILE *f, const char *text ) {
+    if( f ) fprintf( f, "%s\n", text );
+    else mw_printf( "%s\n", text );
+    }
+
+/* a bar chart of bytes over time, one column per group of samples */
+static void mwTimeChart( FILE *f ) {
+    char line[MW_TIMELINE_WIDTH+128];
+    long col[MW_TIMELINE_WIDTH], max = 0, top;
+    int cols, per, i, c, r, peak = 0;
+
+    if( mwTimeUsed == 0 ) return;
+    per = ( mwTimeUsed + MW_TIMELINE_WIDTH - 1 ) / MW_TIMELINE_WIDTH;
+    cols = ( mwTimeUsed + per - 1 ) / per;
+    for( c=0; c<cols; c++ ) col[c] = 0;
+    for( i=0; i<mwTimeUsed; i++ ) {
+        if( mwTime[i].bytes > col[i/per] ) col[i/per] = mwTime[i].bytes;
+        if( mwTime[i].bytes > max ) { max = mwTime[i].bytes; peak = i; }
+        }
+
+    mwTimeLine( f, "" );
+    sprintf( line, "Heap usage over time (%d samples, peak %ld bytes at <%ld>):",
+        mwTimeUsed, max, mwTime[peak].counter );
+    mwTimeLine( f, line );
+    for( r=MW_TIMELINE_HEIGHT; r>0; r-- ) {
+        top = ( max * r + MW_TIMELINE_HEIGHT - 1 ) / MW_TIMELINE_HEIGHT;
+        if( r == MW_TIMELINE_HEIGHT || r == MW_TIMELINE_HEIGHT / 2 ) sprintf( line, "%10ld |", top );
+        else sprintf( line, "%10s |", "" );
+        for( c=0; c<cols; c++ )
+            line[12+c] = max && col[c] * MW_TIMELINE_HEIGHT >= (long) r * max - max / 2 ? '#' : ' ';
+        line[12+cols] = 0;
+        mwTimeLine( f, line );
+        }
+    sprintf( line, "%10s +", "0" );
+    for( c=0; c<cols; c++ ) line[12+c] = '-';
+    line[12+cols] = 0;
+    mwTimeLine( f, line );
+    sprintf( line, "%11s <%ld> to <%ld>", "", mwTime[0].counter, mwTime[mwTimeUsed-1].counter );
+    mwTimeLine( f, line );
+    }
+
+int mwTimelineWrite( const char *path, int chart ) {
+    FILE *f;
+    int i, j;
+
+    mwAutoInit();
+    f = fopen( path, "w" );
+    if( f == NULL ) return 0;
+    MW_MUTEX_LOCK();
+    if( chart ) mwTimeChart( f );
+    else {
+        fprintf( f, "counter,ms,bytes,blocks,nml,overhead,heap,rss" );
+        for( j=1; j<=MW_TIMELINE_TOP; j++ ) fprintf( f, ",site%d,bytes%d", j, j );
+        fprintf( f, "\n" );
+        for( i=0; i<mwTimeUsed; i++ ) {
+            fprintf( f, "%ld,%lu,%ld,%ld,%ld,%ld", mwTime[i].counter,
+                (unsigned long)( mwTime[i].ns / 1000000UL ), mwTime[i].bytes, mwTime[i].blocks,
+                mwTime[i].nml, mwTime[i].overhead );
+            /* left empty where the sample didn't read them */
+            if( mwTime[i].heap >= 0 ) fprintf( f, ",%ld", mwTime[i].heap );
+            else fprintf( f, "," );
+            if( mwTime[i].rss >= 0 ) fprintf( f, ",%ld", mwTime[i].rss );
+            else fprintf( f, "," );
+            for( j=0; j<mwTime[i].sites; j++ )
+                fprintf( f, ",%s(%d),%ld", mwTime[i].site[j].file ? mwTime[i].site[j].file : "<unknown>",
+                    mwTime[i].site[j].line, mwTime[i].site[j].bytes );
+            fprintf( f, "\n" );
+            }
+        }
+    MW_MUTEX_UNLOCK();
+    return fclose( f ) == 0;
+    }
+
+/***********************************************************************
+** Leak suspects
+**
+** For programs that never reach mwAbort(). At the end of each window
+** the live blocks of every site are counted by age, and the site's
+** block count is added to its history. A site whose count has never
+** dropped over the history, and mostly grown, and whose blocks are
+** mostly old, is a suspect. Between windows this costs nothing but
+** the per-site live counts.
+***********************************************************************/
+
+void mwLeakWatch( long ms, int log ) {
+    int i;
+    mwAutoInit();
+    MW_MUTEX_LOCK();
+    mwLeakOn = ms > 0;
+    mwLeakLog = log;
+    if( mwLeakOn ) {
+        mwLeakNs = (mwQWORD) ms * 1000000UL;
+        mwLeakEnd = mwClockNs() + mwLeakNs;
+        for( i=0; i<MW_LEAK_WINDOWS; i++ ) mwLeakMark[i] = mwCounter;
+        }
+    /* blocks counted so far stay MW_SITED, so they are still taken off when freed */
+    mwSiteLive = mwLeakOn || mwTimeOn;
+    MW_MUTEX_UNLOCK();
+    }
+
+int mwLeakSuspect( int n, const char **file, int *line, long *blocks ) {
+    int score = -1;
+    mwAutoInit();
+    MW_MUTEX_LOCK();
+    if( n >= 0 && n < mwLeakUsed ) {
+        if( file ) *file = mwLeakTop[n].file;
+        if( line ) *line = mwLeakTop[n].line;
+        if( blocks ) *blocks = mwLeakTop[n].blocks;
+        score = mwLeakTop[n].score;
+        }
+    MW_MUTEX_UNLOCK();
+    return score;
+    }
+
+/* 0-100, half for steady growth and half for old blocks */
+static int mwLeakScore( mwLeak *leak ) {
+    long old = 0;
+    int i, grew = 0;
+
+    if( leak->windows < 2 || leak->live[0] == 0 ) return 0;
+    for( i=1; i<leak->windows; i++ ) {
+        if( leak->live[i-1] < leak->live[i] ) return 0;
+        if( leak->live[i-1] > leak->live[i] ) grew ++;
+        }
+    if( grew == 0 ) return 0;
+    for( i=MW_LEAK_OLD; i<MW_LEAK_WINDOWS; i++ ) old += leak->age[i];
+    return (int)( grew * 50 / ( MW_LEAK_WINDOWS - 1 ) + old * 50 / leak->live[0] );
+    }
+
+static void mwLeakWindow( void ) {
+    mwLeakEntry entry;
+    mwLeak *leak;
+    mwSite *site;
+    mwData *mw;
+    int i, j;
+
+    mwLeakEnd = mwClockNs() + mwLeakNs;
+    mwLeakWindows ++;
+    for( i=MW_LEAK_WINDOWS-1; i>0; i-- ) mwLeakMark[i] = mwLeakMark[i-1];
+    mwLeakMark[0] = mwCounter;
+
+    /* start a new window for every site with blocks */
+    for( i=0; i<MW_SITE_HASH; i++ ) {
+        for( site=mwSiteTable[i]; site; site=site->next ) {
+            if( site->leak == NULL ) {
+                if( site->liveblocks <= 0 ) continue;
+                site->leak = (mwLeak*) calloc( 1, sizeof(mwLeak) );
+                if( site->leak == NULL ) continue;
+                }
+            leak = site->leak;
+            for( j=MW_LEAK_WINDOWS-1; j>0; j-- ) leak->live[j] = leak->live[j-1];
+            leak->live[0] = site->liveblocks;
+            if( leak->windows < MW_LEAK_WINDOWS ) leak->windows ++;
+            memset( leak->age, 0, sizeof(leak->age) );
+            }
+        }
+
+    /* age the live blocks by the window they were allocated in */
+    for( mw=mwHead; mw; mw=mw->next ) {
+        if( mw->flag & MW_NML ) continue;
+        if( !( mw->flag & MW_SITED ) ) continue;
+        site = mwSiteGet( mw->file, mw->line );
+        if( site == NULL || site->leak == NULL ) continue;
+        for( j=1; j<MW_LEAK_WINDOWS && mw->count < mwLeakMark[j]; j++ ) ;
+        site->leak->age[j-1] ++;
+        }
+
+    /* keep the highest scores, by insertion */
+    mwLeakUsed = 0;
+    for( i=0; i<MW_SITE_HASH; i++ ) {
+        for( site=mwSiteTable[i]; site; site=site->next ) {
+            if( site->leak == NULL ) continue;
+            site->leak->score = mwLeakScore( site->leak );
+            if( site->leak->score < MW_LEAK_SCORE ) continue;
+            entry.file = site->file;
+            entry.line = site->line;
+            entry.bytes = site->livebytes;
+            entry.blocks = site->liveblocks;
+            entry.score = site->leak->score;
+            for( entry.old=0, j=MW_LEAK_OLD; j<MW_LEAK_WINDOWS; j++ ) entry.old += site->leak->age[j];
+            if( mwLeakUsed == MW_LEAK_TOP ) {
+                if( entry.score < mwLeakTop[mwLeakUsed-1].score ||
+                    ( entry.score == mwLeakTop[mwLeakUsed-1].score && entry.bytes <= mwLeakTop[mwLeakUsed-1].bytes ) )
+                    continue;
+                j = mwLeakUsed - 1;
+                }
+            else j = mwLeakUsed ++;
+            for( ; j>0 && ( mwLeakTop[j-1].score < entry.score ||
+                ( mwLeakTop[j-1].score == entry.score && mwLeakTop[j-1].bytes < entry.bytes ) ); j-- )
+                mwLeakTop[j] = mwLeakTop[j-1];
+            mwLeakTop[j] = entry;
+            }
+        }
+
+    if( mwLeakLog && mwLeakUsed ) mwLeakReport( "leak suspects" );
+    }
+
+static void mwLeakReport( const char *title ) {
+    char buf[64];
+    int i;
+
+    mw_printf( "\n%s (<%ld>, window %ld):\n", title, mwCounter, mwLeakWindows );
+    if( mwLeakUsed == 0 ) {
+        mw_printf( " none\n" );
+        return;
+        }
+    mw_printf( " Module/Line                                Bytes      Blocks   Old      Score\n" );
+    for( i=0; i<mwLeakUsed; i++ ) {
+        mwSiteName( buf, mwLeakTop[i].file, mwLeakTop[i].line );
+        mw_printf( " %-42s %-10ld %-8ld %-8ld %d\n", buf, mwLeakTop[i].bytes, mwLeakTop[i].blocks,
+            mwLeakTop[i].old, mwLeakTop[i].score );
+        }
+    }
+
+/***********************************************************************
+** Threads
+**
+** The number of the allocating thread is kept in the top bits of each
+** block's flag word. Threads past MW_THREADS share the counters of
+** slot 0, and are shown as '#0' in the reports.
+***********************************************************************/
+
+#ifdef MW_HAVE_MUTEX
+/* thread exit; list what the thread leaves behind */
+static void mwThreadRelease( void *arg ) {
+    MW_MUTEX_LOCK();
+    if( mwThreadOn ) mwThreadOwned( (unsigned)(size_t) arg );
+    MW_MUTEX_UNLOCK();
+    }
+#endif
+
+void mwThreads( int onoff ) {
+    mwAutoInit();
+    MW_MUTEX_LOCK();
+    mwThreadOn = onoff;
+#ifdef MW_HAVE_MUTEX
+    if( onoff && !mwThreadKeyMade )
+        mwThreadKeyMade = !pthread_key_create( &mwThreadKey, mwThreadRelease );
+#endif
+    MW_MUTEX_UNLOCK();
+    }
+
+unsigned mwThreadOwner( void *p ) {
+    unsigned num = 0;
+    mwData *mw;
+    mwAutoInit();
+    if( p == NULL ) return 0;
+    MW_MUTEX_LOCK();
+    mw = mwBUFFER_TO_MW( p );
+    if( mwIsOwned( mw, __FILE__, __LINE__ ) ) num = mwBLOCKTHREAD(mw);
+    MW_MUTEX_UNLOCK();
+    return num;
+    }
+
+void mwThreadExit( void ) {
+    mwAutoInit();
+    MW_MUTEX_LOCK();
+    mwThreadOwned( mwThreadNum() );
+    MW_MUTEX_UNLOCK();
+    }
+
+/* lists the blocks a thread allocated that are still live */
+static void mwThreadOwned( unsigned num ) {
+    mwData *mw;
+    long n = 0, bytes = 0;
+
+    if( num > MW_THREAD_MAX ) num = MW_THREAD_MAX;
+    for( mw=mwHead; mw; mw=mw->next ) {
+        if( ( mw->flag & MW_NML ) || mwBLOCKTHREAD(mw) != num ) continue;
+        if( n < MW_THREAD_LIST ) {
+            if( n == 0 ) mw_printf( "\nthread #%u exits owning:\n", num );
+            mw_printf( "  <%ld> %s(%d), %ld bytes at %p\n", mw->count, mw->file, mw->line,
+                (long) mw->size, ((char*)mw)+mwDataSize+mwOverflowZoneSize );
+            }
+        n ++;
+        bytes += (long) mw->size;
+        }
+    if( n > MW_THREAD_LIST ) mw_printf( "  ...and %ld more\n", n - MW_THREAD_LIST );
+    if( n ) mw_printf( "thread #%u: %ld bytes in %ld blocks not freed\n", num, bytes, n );
+    }
+
+static void mwThreadReport( void ) {
+    int i, j, any = 0;
+
+    mw_printf( "\nThreads:\n" );
+    mw_printf( " Thread   Allocs     Bytes        Frees      Live bytes   Blocks   Freed elsewhere\n" );
+    for( i=1; i<=MW_THREADS; i++ ) {
+        mwThreadStat *ts = mwThreadStats + i % MW_THREADS;
+        if( ts->allocs == 0 && ts->frees == 0 ) continue;
+        mw_printf( " #%-7d %-10ld %-12ld %-10ld %-12ld %-8ld %ld\n", i % MW_THREADS, ts->allocs,
+            ts->bytes, ts->frees, ts->livebytes, ts->liveblocks, ts->remote );
+        }
+    for( i=0; i<MW_THREADS; i++ ) {
+        for( j=0; j<MW_THREADS; j++ ) {
+            if( mwThreadFrees[i][j] == 0 ) continue;
+            if( !any ++ ) mw_printf( " Allocated by -> freed by:\n" );
+            mw_printf( "  #%d -> #%d: %ld blocks, %ld bytes\n", i, j, mwThreadFrees[i][j], mwThreadBytes[i][j] );
+            }
+        }
+    }
+
+/***********************************************************************
+** Tags
+**
+** Each thread has a stack of tags; blocks are charged to the tag on
+** top of it when allocated, and keep that tag through realloc(). The
+** tag is kept in bits 8-15 of the flag word. Looking a tag up takes
+** the lock only the first time a name is seen.
+***********************************************************************/
+
+/* returns the tag number of a name, adding it if new; zero if full */
+static unsigned mwTagFind( const char *name ) {
+    int i, n;
+    char *copy;
+
+    n = mwTagCount;
+    mwBARRIER();
+    for( i=1; i<=n; i++ ) if( mwTags[i].name == name ) return (unsigned) i;
+    for( i=1; i<=n; i++ ) if( !strcmp( mwTags[i].name, name ) ) return (unsigned) i;
+
+    MW_MUTEX_LOCK();
+    for( i=n+1; i<=mwTagCount; i++ )
+        if( !strcmp( mwTags[i].name, name ) ) {
+            MW_MUTEX_UNLOCK();
+            return (unsigned) i;
+            }
+    if( mwTagCount == MW_TAGS || ( copy = (char*) malloc( strlen( name ) + 1 ) ) == NULL ) {
+        if( mwTagCount == MW_TAGS ) mw_printf( "internal: too many tags, '%s' not counted\n", name );
+        MW_MUTEX_UNLOCK();
+        return 0;
+        }
+    strcpy( copy, name );
+    mwTags[ mwTagCount + 1 ].name = copy;
+    mwBARRIER();
+    i = ++ mwTagCount;
+    MW_MUTEX_UNLOCK();
+    return (unsigned) i;
+    }
+
+void mwPushTag( const char *name ) {
+    mwAutoInit();
+    if( mwTagDepth < MW_TAG_DEPTH )
+        mwTagStack[ mwTagDepth ] = (unsigned char)( name ? mwTagFind( name ) : 0 );
+    else if( mwTagDepth == MW_TAG_DEPTH )
+        mw_printf( "internal: tags nested deeper than %d, '%s' not counted\n",
+            MW_TAG_DEPTH, name ? name : "<untagged>" );
+    mwTagDepth ++;
+    }
+
+void mwPopTag( void ) {
+    if( mwTagDepth > 0 ) mwTagDepth --;
+    }
+
+int mwTagInfo( int n, const char **name, long *cur, long *peak, long *total ) {
+    mwTagStat *tp;
+    if( n < 0 || n >= mwTagCount ) return 0;
+    tp = mwTags + n + 1;
+    if( name ) *name = tp->name;
+    if( cur ) *cur = tp->cur;
+    if( peak ) *peak = tp->peak;
+    if( total ) *total = tp->total;
+    return 1;
+    }
+
+static void mwTagReport( void ) {
+    mwTagStat *tp;
+    int i;
+
+    mw_printf( "\nMemory by tag:\n" );
+    mw_printf( " Tag                      Current      Peak         Total        Allocs     Frees\n" );
+    for( i=1; i<=mwTagCount; i++ ) {
+        tp = mwTags + i;
+        mw_printf( " %-24.24s %-12ld %-12ld %-12ld %-10ld %ld\n", tp->name, tp->cur, tp->peak,
+            tp->total, tp->allocs, tp->frees );
+        }
+    }
+
+/***********************************************************************
+** Quotas
+**
+** A block is charged to the quota of its tag if it has one, otherwise
+** to the first file quota its site matches. Which quota a site has is
+** cached in the site, and the block's quota is kept in bits 3-7 of its
+** flag word, so both charging and refunding are constant time.
+***********************************************************************/
+
+int mwQuota( const char *match, long soft, long hard, void (*func)( const char *match, long bytes ) ) {
+    mwQuotaDef *qd;
+    unsigned tag = 0;
+    int i;
+
+    mwAutoInit();
+    if( match == NULL || *match == 0 ) return 0;
+    if( !strncmp( match, "tag:", 4 ) && ( tag = mwTagFind( match + 4 ) ) == 0 ) return 0;
+    MW_MUTEX_LOCK();
+    for( i=1; i<=mwQuotaCount; i++ )
+        if( !strcmp( mwQuotas[i].match, match ) ) break;
+    if( i > mwQuotaCount ) {
+        if( mwQuotaCount == MW_QUOTAS || ( mwQuotas[i].match = (char*) malloc( strlen( match ) + 1 ) ) == NULL ) {
+            mw_printf( "internal: no room for quota '%s'\n", match );
+            MW_MUTEX_UNLOCK();
+            return 0;
+            }
+        strcpy( mwQuotas[i].match, match );
+        mwQuotaCount ++;
+        if( tag ) mwTagQuota[tag] = (unsigned char) i;
+        else mwQuotaFiles ++;
+        mwQuotaGen ++;
+        }
+    qd = mwQuotas + i;
+    qd->tag = tag;
+    qd->soft = soft;
+    qd->hard = hard;
+    qd->func = func;
+    qd->over = soft && qd->cur > soft;
+    mw_printf( "quota: '%s', soft limit %ld, hard limit %ld bytes\n", match, soft, hard );
+    MW_MUTEX_UNLOCK();
+    return i;
+    }
+
+long mwQuotaUsed( int n, long *peak ) {
+    long cur = -1L;
+    MW_MUTEX_LOCK();
+    if( n > 0 && n <= mwQuotaCount ) {
+        cur = mwQuotas[n].cur;
+        if( peak ) *peak = mwQuotas[n].peak;
+        }
+    MW_MUTEX_UNLOCK();
+    return cur;
+    }
+
+static unsigned mwQuotaOf( const char *file, int line, unsigned tag ) {
+    mwSite *site;
+    int i;
+
+    if( mwTagQuota[tag] ) return mwTagQuota[tag];
+    if( mwQuotaFiles == 0 || ( site = mwSiteGet( file, line ) ) == NULL ) return 0;
+    if( site->qgen != mwQuotaGen ) {
+        site->qgen = mwQuotaGen;
+        site->quota = 0;
+        for( i=1; i<=mwQuotaCount && file; i++ )
+            if( mwQuotas[i].tag == 0 && strstr( file, mwQuotas[i].match ) ) {
+                site->quota = (unsigned) i;
+                break;
+                }
+        }
+    return site->quota;
+    }
+
+/* calls a soft limit's func, outside the lock so it can free memory */
+static void mwQuotaNotify( void ) {
+    mwQuotaDef *qd = mwQuotas + mwQuotaPending;
+    mwQuotaPending = 0;
+    if( qd->func ) (*qd->func)( qd->match, qd->cur );
+    }
+
+static void mwQuotaReport( void ) {
+    mwQuotaDef *qd;
+    int i;
+
+    mw_printf( "\nQuotas:\n" );
+    mw_printf( " Quota                    Soft         Hard         Current      Peak         Passed   Failed\n" );
+    for( i=1; i<=mwQuotaCount; i++ ) {
+        qd = mwQuotas + i;
+        mw_printf( " %-24.24s %-12ld %-12ld %-12ld %-12ld %-8ld %ld\n", qd->match, qd->soft, qd->hard,
+            qd->cur, qd->peak, qd->softs, qd->fails );
+        }
+    }
+
+/***********************************************************************
+** Scopes
+**
+** Each open scope has a list of the live blocks allocated in it, so
+** ending one only visits the blocks that survive it. Survivors are
+** reported and then taken off the list; they are not passed on to the
+** enclosing scope.
+***********************************************************************/
+
+unsigned mwScopeBegin( const char *file, int line ) {
+    mwScope *scope;
+
+    mwAutoInit();
+    scope = (mwScope*) malloc( sizeof(mwScope) );
+    if( scope == NULL ) {
+        mw_printf( "internal: memory low, scope at %s(%d) not tracked\n", file, line );
+        return 0;
+        }
+    scope->head = NULL;
+    scope->file = file;
+    scope->line = line;
+    MW_MUTEX_LOCK();
+    scope->id = ++ mwScopeCount;
+    MW_MUTEX_UNLOCK();
+    scope->up = mwScopeTop;
+    mwScopeTop = scope;
+    return scope->id;
+    }
+
+/* nonzero if the block's scope links look like a scope list's */
+static int mwScopeLinked( mwData *mw ) {
+    if( !mwIsSafeAddr( mw->scope, sizeof(mwScope) ) ) return 0;
+    if( mw->sprev == NULL ) {
+        if( mw->scope->head != mw ) return 0;
+        }
+    else if( !mwIsSafeAddr( mw->sprev, mwDataSize ) || mw->sprev->snext != mw ) return 0;
+    if( mw->snext != NULL && ( !mwIsSafeAddr( mw->snext, mwDataSize ) || mw->snext->sprev != mw ) ) return 0;
+    return 1;
+    }
+
+/*
+** Takes a block whose own scope links can't be trusted out of the
+** scope list it's in, going by its neighbours' links instead. Only the
+** calling thread's open scopes are searched.
+*/
+static void mwScopeRepair( mwData *mw ) {
+    mwScope *scope;
+    mwData *b, *prev, *next = NULL;
+
+    for( b=mwHead; b; b=b->next )
+        if( b != mw && !( b->flag & MW_NML ) && b->scope && b->sprev == mw ) { next = b; break; }
+    for( scope=mwScopeTop; scope; scope=scope->up ) {
+        for( prev=NULL, b=scope->head; b; prev=b, b=b->snext ) {
+            if( b != mw ) continue;
+            if( prev ) prev->snext = next;
+            else scope->head = next;
+            if( next ) next->sprev = prev;
+            return;
+            }
+        }
+    }
+
+long mwScopeEnd( const char *file, int line ) {
+    mwScope *scope = mwScopeTop;
+    mwData *mw, *next;
+    long n = 0, bytes = 0;
+
+    mwAutoInit();
+    if( scope == NULL ) {
+        mw_printf( "scope: <%ld> %s(%d), mwScopeEnd() without mwScopeBegin()\n", mwCounter, file, line );
+        return 0L;
+        }
+    mwScopeTop = scope->up;
+
+    MW_MUTEX_LOCK();
+    for( mw=scope->head; mw; mw=next ) {
+        next = mw->snext;
+        if( next != NULL && ( !mwIsSafeAddr( next, mwDataSize ) || next->sprev != mw ) ) {
+            mw_printf( "internal: <%ld> %s(%d), MW-%p scope links damaged, scope list cut short\n",
+                mwCounter, file, line, mw );
+            next = NULL;
+            }
+        if( n == 0 )
+            mw_printf( "scope: <%ld> %s(%d), scope #%u from %s(%d) ended with survivors:\n",
+                mwCounter, file, line, scope->id, scope->file, scope->line );
+        if( n < MW_SCOPE_LIST )
+            mw_printf( "  <%ld> %s(%d), %ld bytes at %p\n", mw->count, mw->file, mw->line,
+                (long) mw->size, ((char*)mw)+mwDataSize+mwOverflowZoneSize );
+        n ++;
+        bytes += (long) mw->size;
+        mw->scope = NULL;
+        mw->sprev = mw->snext = NULL;
+        }
+    if( n > MW_SCOPE_LIST ) mw_printf( "  ...and %ld more\n", n - MW_SCOPE_LIST );
+    if( n ) {
+        mw_printf( "scope #%u: %ld bytes in %ld blocks not freed\n", scope->id, bytes, n );
+        mwPROBE5( error, "scope", NULL, file, line, mwCounter );
+        mwScopeLeaky ++;
+        mwScopeBlocks += n;
+        mwScopeBytes += bytes;
+        }
+    MW_MUTEX_UNLOCK();
+    free( scope );
+    return n;
+    }
+
+/***********************************************************************
+** Process memory
+**
+** Where the resident memory goes: the bytes the program asked for,
+** memwatch's own headers, guards and no-mans-land, the C library's
+** rounding and chunk headers, other malloc() users, free memory held
+** by the C library, and the rest of the process.
+***********************************************************************/
+
+/* resident bytes from /proc/self/smaps_rollup or statm; -1 if unknown */
+static long mwProcRss( int rollup, long *anon ) {
+#ifdef MW_HAVE_PROC
+    char buf[1024], *p;
+    long rss = -1L, size;
+    int fd, n;
+
+    if( anon ) *anon = -1L;
+    if( rollup && ( fd = open( "/proc/self/smaps_rollup", O_RDONLY ) ) >= 0 ) {
+        n = (int) read( fd, buf, sizeof(buf)-1 );
+        close( fd );
+        if( n > 0 ) {
+            buf[n] = 0;
+            if( ( p = strstr( buf, "\nRss:" ) ) != NULL ) rss = atol( p + 5 ) * 1024L;
+            if( anon && ( p = strstr( buf, "\nAnonymous:" ) ) != NULL ) *anon = atol( p + 11 ) * 1024L;
+            if( rss >= 0 ) return rss;
+            }
+        }
+    if( ( fd = open( "/proc/self/statm", O_RDONLY ) ) >= 0 ) {
+        n = (int) read( fd, buf, sizeof(buf)-1 );
+        close( fd );
+        if( n > 0 ) {
+            buf[n] = 0;
+            size = strtol( buf, &p, 10 );
+            rss = strtol( p, NULL, 10 ) * sysconf( _SC_PAGESIZE );
+            (void) size;
+            }
+        }
+    return rss;
+#else
+    if( anon ) *anon = -1L;
+    (void) rollup;
+    return -1L;
+#endif
+    }
+
+/* the C library's heap, mapped chunks included; -1 if unknown */
+static long mwHeapSize( long *inuse ) {
+#ifdef MW_HAVE_MALLINFO
+    mwMallinfo mi = mwMALLINFO();
+    if( inuse ) *inuse = (long)( mi.uordblks + mi.hblkhd );
+    return (long)( mi.arena + mi.hblkhd );
+#else
+    if( inuse ) *inuse = -1L;
+    return -1L;
+#endif
+    }
+
+int mwMemUsage( long *usage ) {
+    int ok;
+
+    mwAutoInit();
+    MW_MUTEX_LOCK();
+    ok = mwMemTake( usage );
+    MW_MUTEX_UNLOCK();
+    return ok;
+    }
+
+/* as mwMemUsage(), for callers that hold the lock or are tearing down */
+static int mwMemTake( long *usage ) {
+    mwData *mw;
+    long ovh = 0, slack = 0, heap, inuse;
+    long per = (long)( mwDataSize + mwOverflowZoneSize*2 );
+    int i;
+
+    for( mw=mwHead; mw; mw=mw->next ) {
+        ovh += per;
+        if( mw->flag & MW_NML ) ovh += (long) mw->size;
+#ifdef MW_HAVE_MALLINFO
+        slack += (long)( malloc_usable_size( mw ) + sizeof(size_t) ) - per - (long) mw->size;
+#endif
+        }
+    usage[MW_MEM_USER] = mwStatCurAlloc;
+    usage[MW_MEM_OVERHEAD] = ovh;
+    usage[MW_MEM_SLACK] = slack;
+
+    heap = mwHeapSize( &inuse );
+    usage[MW_MEM_RSS] = mwProcRss( 1, NULL );
+    if( heap < 0 ) {
+        inuse = heap = usage[MW_MEM_USER] + ovh + slack;
+        }
+    usage[MW_MEM_UNTRACKED] = inuse - usage[MW_MEM_USER] - ovh - slack;
+    usage[MW_MEM_FREE] = heap - inuse;
+    usage[MW_MEM_OTHER] = usage[MW_MEM_RSS] - heap;
+    for( i=0; i<MW_MEM_RSS; i++ ) if( usage[i] < 0 ) usage[i] = 0;
+    return usage[MW_MEM_RSS] >= 0;
+    }
+
+static void mwMemReport( void ) {
+    static const char *what[MW_MEM_RSS] = {
+        "U)ser bytes                ",
+        "M)emwatch headers & NML    ",
+        "A)llocator slack           ",
+        "O)ther malloc() users      ",
+        "F)ree in allocator         ",
+        "R)est of process           "
+        };
+    int i;
+
+    if( !mwMemEndOk || mwMemEnd[MW_MEM_RSS] <= 0 ) return;
+    mw_printf( "\nResident memory at exit (%ld bytes):\n", mwMemEnd[MW_MEM_RSS] );
+    for( i=0; i<MW_MEM_RSS; i++ )
+        mw_printf( " %s: %-12ld %ld%%\n", what[i], mwMemEnd[i], mwMemEnd[i] * 100 / mwMemEnd[MW_MEM_RSS] );
+    }
+
+/***********************************************************************
+** Unfreed blocks by site
+**
+** With many leaked blocks, a line for each takes long to write and
+** longer to read; instead they are summed by site in one pass, and
+** the sites with the most bytes are listed with a few of their blocks.
+***********************************************************************/
+
+/* hex and text of the first 16 bytes of a block */
+static void mwUnfreedDump( mwData *mw, char *dump ) {
+    char *data = ((char*)mw) + mwDataSize + mwOverflowZoneSize;
+    int c, i, j;
+
+    j = 16; if( mw->size < 16 ) j = (int) mw->size;
+    for( i=0;i<16;i++ ) {
+        if( i<j ) sprintf( dump+i*3, "%02X ", (unsigned char) *(data+i) );
+        else strcpy( dump+i*3, ".. " );
+        }
+    for( i=0;i<j;i++ ) {
+        c = *(data+i);
+        if( c < 32 || c > 126 ) c = '.';
+        dump[48+i] = (char) c;
+        }
+    dump[48+j] = 0;
+    }
+
+static void mwUnfreedAdd( mwData *mw ) {
+    mwSite *site = mwSiteGet( mw->file, mw->line );
+    mwUnfreedSite *uf;
+    char *data = ((char*)mw) + mwDataSize;
+
+    if( site == NULL ) return;
+    if( site->unfreed == NULL ) {
+        site->unfreed = (mwUnfreedSite*) calloc( 1, sizeof(mwUnfreedSite) );
+        if( site->unfreed == NULL ) return;
+        mwUnfreedDump( mw, site->unfreed->dump );
+        }
+    uf = site->unfreed;
+    uf->bytes += (long) mw->size;
+    uf->blocks ++;
+    if( mwCheckOF( data ) || mwCheckOF( data+mwOverflowZoneSize+mw->size ) ) uf->damaged ++;
+    if( uf->samples < MW_UNFREED_SAMPLES ) uf->sample[ uf->samples++ ] = data + mwOverflowZoneSize;
+    }
+
+static int mwUnfreedBySize( const void *a, const void *b ) {
+    long x = (*(mwSite* const*) a)->unfreed->bytes, y = (*(mwSite* const*) b)->unfreed->bytes;
+    return x > y ? -1 : x < y;
+    }
+
+static int mwUnfreedWanted( mwSite *site ) {
+    return site->unfreed != NULL;
+    }
+
+static void mwUnfreedReport( void ) {
+    mwSite **list;
+    char buf[64], at[MW_UNFREED_SAMPLES*24+1];
+    long n, i, bytes = 0, blocks = 0, top;
+    int j, len;
+
+    list = mwSiteList( mwUnfreedWanted, mwUnfreedBySize, &n );
+    if( list == NULL ) return;
+    for( i=0; i<n; i++ ) {
+        bytes += list[i]->unfreed->bytes;
+        blocks += list[i]->unfreed->blocks;
+        }
+
+    top = mwUnfreedTop ? mwUnfreedTop : MW_UNFREED_TOP;
+    mw_printf( "\nUnfreed: %ld bytes in %ld blocks from %ld sites:\n", bytes, blocks, n );
+    mw_printf( " Module/Line                                Bytes      Blocks\n" );
+    for( i=0; i<n; i++ ) {
+        mwUnfreedSite *uf = list[i]->unfreed;
+        if( i < top ) {
+            mw_printf( " %-42s %-10ld %ld%s\n", mwSiteName( buf, list[i]->file, list[i]->line ), uf->bytes, uf->blocks,
+                uf->damaged ? " [overflowed]" : "" );
+            for( len=0, j=0; j<uf->samples; j++ ) len += sprintf( at+len, " %p", uf->sample[j] );
+            mw_printf( "   at%s%s {%s}\n", at, uf->blocks > uf->samples ? " ..." : "", uf->dump );
+            bytes -= uf->bytes;
+            blocks -= uf->blocks;
+            }
+        free( uf );
+        list[i]->unfreed = NULL;
+        }
+    if( n > top )
+        mw_printf( " %-42s %-10ld %ld\n", "(other sites)", bytes, blocks );
+    free( list );
     }
 
-
 /***********************************************************************
 ** Abort/Retry/Ignore handlers
 ***********************************************************************/
@@ -816,11 +3737,33 @@ void mwSetAriFunc( int (*func)(const char *) ) {
 
 void* mwMalloc( size_t size, const char* file, int line) {
     size_t needed;
+    unsigned stack = 0;
+    int i;
+    mwLife *life;
+    mwChurnSite *churn;
+    mwSite *site;
+    mwThreadStat *ts;
+    mwTagStat *tp;
+    unsigned thread = mwThreadNum();
+    unsigned tag, quota = 0, qfrom = mwQuotaFrom;
+    long now, old, credit = mwQuotaCredit;
+    mwQuotaDef *qd = NULL;
+    mwScope *scope;
     mwData *mw;
     char *ptr;
     void *p;
     mwAutoInit();
 
+    /* unwind before locking; realloc() and friends pass theirs in */
+    if( mwStackNext ) { stack = mwStackNext; mwStackNext = 0; }
+    else if( mwStackLevel ) stack = mwStackCapture( 1 );
+    if( mwTagNext >= 0 ) { tag = (unsigned) mwTagNext; mwTagNext = -1; }
+    else tag = mwTagDepth ? mwTagStack[ ( mwTagDepth < MW_TAG_DEPTH ? mwTagDepth : MW_TAG_DEPTH ) - 1 ] : 0;
+    mwQuotaFrom = 0;
+    mwQuotaCredit = 0L;
+    if( mwScopeKeep ) { scope = mwScopeNext; mwScopeKeep = 0; }
+    else scope = mwScopeTop;
+
     MW_MUTEX_LOCK();
 
     TESTS(file,line);
@@ -837,9 +3780,34 @@ void* mwMalloc( size_t size, const char* file, int line) {
     if( mwUseLimit && ((long)size + mwStatCurAlloc > mwAllocLimit) ) {
         mw_printf( "limit fail: <%ld> %s(%d), %ld wanted %ld available\n",
             mwCounter, file, line, (long)size, mwAllocLimit - mwStatCurAlloc );
+        mwPROBE5( error, "limit", NULL, file, line, mwCounter );
+        MW_MUTEX_UNLOCK();
+        return NULL;
+        }
+
+    /* the quota's hard limit; realloc() is only charged the difference */
+    if( mwQuotaCount && ( quota = mwQuotaOf( file, line, tag ) ) != 0 ) {
+        qd = mwQuotas + quota;
+        if( quota != qfrom ) credit = 0L;
+        if( qd->hard && (long)size - credit + qd->cur > qd->hard ) {
+            qd->fails ++;
+            mw_printf( "quota fail: <%ld> %s(%d), %ld wanted, quota '%s' has %ld of %ld\n",
+                mwCounter, file, line, (long)size, qd->match, qd->hard - qd->cur, qd->hard );
+            mwPROBE5( error, "quota", NULL, file, line, mwCounter );
+            MW_MUTEX_UNLOCK();
+            return NULL;
+            }
+        }
+
+#ifdef MW_PTRHASH
+    if( !mwPtrRoom() ) {
+        mw_printf( "fail: <%ld> %s(%d), %ld wanted, no room in the pointer hash\n",
+            mwCounter, file, line, (long)size );
+        mwPROBE5( error, "fail", NULL, file, line, mwCounter );
         MW_MUTEX_UNLOCK();
         return NULL;
         }
+#endif
 
     mw = (mwData*) malloc( needed );
     if( mw == NULL ) {
@@ -853,6 +3821,7 @@ void* mwMalloc( size_t size, const char* file, int line) {
         if( mw == NULL ) {
             mw_printf( "fail: <%ld> %s(%d), %ld wanted %ld allocated\n",
                 mwCounter, file, line, (long)size, mwStatCurAlloc );
+            mwPROBE5( error, "fail", NULL, file, line, mwCounter );
             MW_MUTEX_UNLOCK();
             return NULL;
             }
@@ -864,12 +3833,74 @@ void* mwMalloc( size_t size, const char* file, int line) {
     mw->file = file;
     mw->size = size;
     mw->line = line;
-    mw->flag = 0;
+    mw->flag = ( thread < MW_THREAD_MAX ? thread : MW_THREAD_MAX ) << MW_THREAD_SHIFT;
+    if( tag ) {
+        mw->flag |= tag << MW_TAG_SHIFT;
+        tp = mwTags + tag;
+        mwATOMIC_ADD( &tp->allocs, 1 );
+        mwATOMIC_ADD( &tp->total, (long) size );
+        now = mwATOMIC_ADD( &tp->cur, (long) size ) + (long) size;
+        while( ( old = tp->peak ) < now && !mwCAS( &tp->peak, old, now ) ) ;
+        }
+    if( mwThreadOn ) {
+        mw->flag |= MW_THREADED;
+        ts = mwThreadStats + mwTHREADSLOT(thread);
+        ts->allocs ++;
+        ts->bytes += (long) size;
+        ts->livebytes += (long) size;
+        ts->liveblocks ++;
+#ifdef MW_HAVE_MUTEX
+        if( !mwThreadKeyed && mwThreadKeyMade )
+            mwThreadKeyed = !pthread_setspecific( mwThreadKey, (void*)(size_t) thread );
+#endif
+        }
+    if( qd ) {
+        mw->flag |= quota << MW_QUOTA_SHIFT;
+        qd->cur += (long) size;
+        if( qd->cur > qd->peak ) qd->peak = qd->cur;
+        if( qd->soft && qd->cur - credit > qd->soft && !qd->over ) {
+            qd->over = 1;
+            qd->softs ++;
+            if( qd->func ) mwQuotaPending = (int) quota;
+            }
+        }
+    mw->stack = stack;
+    mw->moves = 0;
+    mw->scope = scope;
+    mw->sprev = NULL;
+    mw->snext = NULL;
+    if( scope ) {
+        if( scope->head ) scope->head->sprev = mw;
+        mw->snext = scope->head;
+        scope->head = mw;
+        }
+    if( mwChurnOn && ( churn = mwChurnGet( file, line ) ) != NULL ) {
+        mw->flag |= MW_CHURNED;
+        if( churn->allocs ++ == 0 ) churn->size = size;
+        if( churn->size == size ) churn->same ++;
+        churn->bytes += (long) size;
+        churn->livesum += ++ churn->live;
+        if( churn->live > churn->maxlive ) churn->maxlive = churn->live;
+        }
+    mw->born = 0;
+    if( mwLifeOn && ( life = mwLifeGet( file, line ) ) != NULL ) {
+        mw->born = mwClockNs();
+        life->allocs ++;
+        }
+    if( mwSiteLive && ( site = mwSiteGet( file, line ) ) != NULL ) {
+        mw->flag |= MW_SITED;
+        site->livebytes += (long) size;
+        site->liveblocks ++;
+        }
     mw->check = CHKVAL(mw);
 
     if( mwHead ) mwHead->prev = mw;
     mwHead = mw;
     if( mwTail == NULL ) mwTail = mw;
+    mwTabAdd( mw );
+#ifdef MW_PTRHASH
+    mwPtrAdd( mw );
+#endif
 
     ptr = ((char*)mw) + mwDataSize;
     mwWriteOF( ptr ); /* '*(long*)ptr = PRECHK;' */
@@ -882,23 +3913,36 @@ void* mwMalloc( size_t size, const char* file, int line) {
     mwNumCurAlloc ++;
     mwStatCurAlloc += (long) size;
     mwStatTotAlloc += (long) size;
-    if( mwStatCurAlloc > mwStatMaxAlloc )
+    if( mwStatCurAlloc > mwStatMaxAlloc ) {
         mwStatMaxAlloc = mwStatCurAlloc;
+        mwPeakDirty = mwPeakOn;
+        }
     mwStatNumAlloc ++;
+    i = mwSizeClass( size );
+    mwHistAlloc[i] ++;
+    mwHistLive[i] ++;
 
     if( mwStatLevel ) mwStatAlloc( size, file, line );
+    if( stack ) mwStackAdd( stack, (long) size );
+    if( mwRecFile || mwFlight ) mwEvent( MWT_ALLOC, file, line, size, p, NULL, 0, 0 );
+    mwPROBE5( malloc, p, size, file, line, mwCounter );
+    if( mwTimeOn ) mwTimeSample();
+    if( mwLeakOn && !( mwCounter & 63 ) && mwClockNs() >= mwLeakEnd ) mwLeakWindow();
 
     MW_MUTEX_UNLOCK();
+    if( mwQuotaPending && !mwQuotaHold ) mwQuotaNotify();
     return p;
     }
 
 void* mwRealloc( void *p, size_t size, const char* file, int line) {
     int oldUseLimit, i;
+    size_t oldsize;
     mwData *mw;
     char *ptr;
 
     mwAutoInit();
 
+    if( mwStackLevel && ( p == NULL || size != 0 ) ) mwStackNext = mwStackCapture( 1 );
     if( p == NULL ) return mwMalloc( size, file, line );
     if( size == 0 ) { mwFree( p, file, line ); return NULL; }
 
@@ -925,6 +3969,8 @@ void* mwRealloc( void *p, size_t size, const char* file, int line) {
             mwCounter ++;
             mw_printf( "limit fail: <%ld> %s(%d), %ld wanted %ld available\n",
                 mwCounter, file, line, (unsigned long)size - mw->size, mwAllocLimit - mwStatCurAlloc );
+            mwPROBE5( error, "limit", p, file, line, mwCounter );
+            mwStackNext = 0;
             MW_MUTEX_UNLOCK();
             return NULL;
             }
@@ -932,16 +3978,28 @@ void* mwRealloc( void *p, size_t size, const char* file, int line) {
         /* fake realloc operation */
         oldUseLimit = mwUseLimit;
         mwUseLimit = 0;
+        mwTagNext = (int) mwBLOCKTAG(mw) <= mwTagCount ? (int) mwBLOCKTAG(mw) : 0;
+        mwQuotaFrom = (int) mwBLOCKQUOTA(mw) <= mwQuotaCount ? mwBLOCKQUOTA(mw) : 0;
+        mwQuotaCredit = (long) mw->size;
+        mwQuotaHold = 1;
+        mwScopeNext = mw->scope && mwScopeLinked( mw ) ? mw->scope : NULL;
+        mwScopeKeep = 1;
         ptr = (char*) mwMalloc( size, file, line );
         if( ptr != NULL ) {
+            oldsize = mw->size;
             if( size < mw->size )
                 memcpy( ptr, p, size );
             else
                 memcpy( ptr, p, mw->size );
+            mwGrowAdd( mw, mwBUFFER_TO_MW( ptr ), file, line );
             mwFree( p, file, line );
+            if( mwRecFile || mwFlight ) mwEvent( MWT_REALLOC, file, line, size, ptr, p, oldsize, 0 );
+            mwPROBE6( realloc, ptr, p, size, file, line, mwCounter );
             }
         mwUseLimit = oldUseLimit;
+        mwQuotaHold = 0;
         MW_MUTEX_UNLOCK();
+        if( mwQuotaPending ) mwQuotaNotify();
         return (void*) ptr;
         }
 
@@ -949,12 +4007,15 @@ void* mwRealloc( void *p, size_t size, const char* file, int line) {
 
     /* using free'd pointer? */
 check_dbl_free:
+    mwStackNext = 0;
     for(i=0;i<MW_FREE_LIST;i++) {
         if( mwLastFree[i] == p ) {
             mw_printf( "realloc: <%ld> %s(%d), %p was"
                 " freed from %s(%d)\n",
                 mwCounter, file, line, p,
                 mwLFfile[i], mwLFline[i] );
+            if( mwLFstack[i] ) mwStackPrint( mwLFstack[i] );
+            mwPROBE5( error, "realloc-after-free", p, file, line, mwCounter );
             
             MW_MUTEX_UNLOCK();
             return NULL;
@@ -964,6 +4025,7 @@ check_dbl_free:
     /* some weird pointer */
     mw_printf( "realloc: <%ld> %s(%d), unknown pointer %p\n",
         mwCounter, file, line, p );
+    mwPROBE5( error, "wild-realloc", p, file, line, mwCounter );
     
     MW_MUTEX_UNLOCK();
     return NULL;
@@ -984,14 +4046,23 @@ char *mwStrdup( const char* str, const char* file, int line ) {
         }
 
     len = strlen( str ) + 1;
+    if( mwStackLevel ) mwStackNext = mwStackCapture( 1 );
+    mwQuotaHold = 1;
     newstring = (char*) mwMalloc( len, file, line );
     if( newstring != NULL ) memcpy( newstring, str, len );
+    mwQuotaHold = 0;
     MW_MUTEX_UNLOCK();
+    if( mwQuotaPending ) mwQuotaNotify();
     return newstring;
     }
 
 void mwFree( void* p, const char* file, int line ) {
-    int i;
+    int i, j;
+    unsigned stack = 0;
+    mwLife *life;
+    mwGrow *grow;
+    mwChurnSite *churn;
+    mwSite *site;
     mwData* mw;
     char buffer[ sizeof(mwData) + (mwROUNDALLOC*3) + 64 ];
 
@@ -1004,6 +4075,8 @@ void mwFree( void* p, const char* file, int line ) {
 
     mwAutoInit();
 
+    if( mwStackLevel >= MW_STACK_FREE && p != NULL ) stack = mwStackCapture( 1 );
+
     MW_MUTEX_LOCK();
     TESTS(file,line);
     mwCounter ++;
@@ -1012,6 +4085,7 @@ void mwFree( void* p, const char* file, int line ) {
     if( p == NULL ) {
         mw_printf( "NULL free: <%ld> %s(%d), NULL pointer free'd\n",
             mwCounter, file, line );
+        mwPROBE5( error, "null-free", NULL, file, line, mwCounter );
         
         MW_MUTEX_UNLOCK();
         return;
@@ -1034,14 +4108,81 @@ void mwFree( void* p, const char* file, int line ) {
             goto check_dbl_free;
         }
 
+        /* the heap is at its peak if this is the first free since */
+        if( mwPeakDirty ) mwPeakCapture();
+
         /* update the statistics */
         mwNumCurAlloc --;
         mwStatCurAlloc -= (long) mw->size;
+        mwHistLive[ mwSizeClass( mw->size ) ] --;
+        if( ( mw->flag & MW_SITED ) && ( site = mwSiteGet( mw->file, mw->line ) ) != NULL ) {
+            site->livebytes -= (long) mw->size;
+            site->liveblocks --;
+            }
+        if( mw->scope && !mwScopeLinked( mw ) ) {
+            mw_printf( "internal: <%ld> %s(%d), MW-%p scope links damaged\n",
+                mwCounter, file, line, mw );
+            mwScopeRepair( mw );
+            mw->scope = NULL;
+            }
+        if( mw->scope ) {
+            if( mw->sprev ) mw->sprev->snext = mw->snext;
+            else mw->scope->head = mw->snext;
+            if( mw->snext ) mw->snext->sprev = mw->sprev;
+            mw->scope = NULL;
+            }
+        if( (int) mwBLOCKQUOTA(mw) > mwQuotaCount )
+            mw_printf( "internal: <%ld> %s(%d), MW-%p has quota #%d, but there are %d\n",
+                mwCounter, file, line, mw, (int) mwBLOCKQUOTA(mw), mwQuotaCount );
+        else if( mwBLOCKQUOTA(mw) ) {
+            mwQuotaDef *qd = mwQuotas + mwBLOCKQUOTA(mw);
+            qd->cur -= (long) mw->size;
+            if( qd->cur <= qd->soft ) qd->over = 0;
+            }
+        if( (int) mwBLOCKTAG(mw) > mwTagCount )
+            mw_printf( "internal: <%ld> %s(%d), MW-%p has tag #%d, but there are %d\n",
+                mwCounter, file, line, mw, (int) mwBLOCKTAG(mw), mwTagCount );
+        else if( mwBLOCKTAG(mw) ) {
+            mwATOMIC_ADD( &mwTags[ mwBLOCKTAG(mw) ].frees, 1 );
+            mwATOMIC_ADD( &mwTags[ mwBLOCKTAG(mw) ].cur, - (long) mw->size );
+            }
+        if( mw->flag & MW_THREADED ) {
+            i = mwTHREADSLOT( mwBLOCKTHREAD(mw) );
+            j = mwTHREADSLOT( mwThreadNum() );
+            mwThreadStats[i].livebytes -= (long) mw->size;
+            mwThreadStats[i].liveblocks --;
+            mwThreadStats[j].frees ++;
+            if( mwBLOCKTHREAD(mw) != mwThreadNum() ) {
+                mwThreadStats[i].remote ++;
+                mwThreadFrees[i][j] ++;
+                mwThreadBytes[i][j] += (long) mw->size;
+                }
+            }
+        if( ( mw->flag & MW_CHURNED ) && ( churn = mwChurnGet( mw->file, mw->line ) ) != NULL && churn->live > 0 ) {
+            churn->frees ++;
+            churn->live --;
+            }
+        if( mw->moves && ( grow = mwGrowGet( mw->file, mw->line ) ) != NULL ) {
+            grow->chains ++;
+            grow->moves += mw->moves;
+            if( (long) mw->moves > grow->longest ) grow->longest = mw->moves;
+            grow->final[ mwSizeClass( mw->size ) ] ++;
+            }
+        if( mw->born && ( life = mwLifeGet( mw->file, mw->line ) ) != NULL ) {
+            life->frees ++;
+            life->ops[ mwLifeClass( (mwQWORD)( mwCounter - mw->count ) ) ] ++;
+            life->ns[ mwLifeClass( mwClockNs() - mw->born ) ] ++;
+            }
         if( mwStatLevel ) mwStatFree( mw->size, mw->file, mw->line );
+        if( mw->stack ) mwStackAdd( mw->stack, - (long) mw->size );
+        if( mwRecFile || mwFlight ) mwEvent( MWT_FREE, mw->file, mw->line, mw->size, p, NULL, 0,
+            (long)( mwCounter - mw->count ) );
+        mwPROBE5( free, p, mw->size, file, line, mwCounter );
 
         /* we should either free the allocation or keep it as NML */
         if( mwNML ) {
             mw->flag |= MW_NML;
+            mwTabUpdate( mw );
             mwNmlNumAlloc ++;
             mwNmlCurAlloc += (long) mw->size;
             memset( ((char*)mw)+mwDataSize+mwOverflowZoneSize, MW_VAL_NML, mw->size );
@@ -1049,6 +4190,7 @@ void mwFree( void* p, const char* file, int line ) {
         else {
             /* unlink the allocation, and enter the post-free data */
             mwUnlink( mw, file, line );
+            MW_RELEASED( mw->size );
             memset( mw, MW_VAL_DEL,
                 mw->size + mwDataSize+mwOverflowZoneSize+mwOverflowZoneSize );
             if( mwFBI ) {
@@ -1062,8 +4204,11 @@ void mwFree( void* p, const char* file, int line ) {
         /* add the pointer to the last-free track */
         mwLFfile[ mwLFcur ] = file;
         mwLFline[ mwLFcur ] = line;
+        mwLFstack[ mwLFcur ] = stack;
         mwLastFree[ mwLFcur++ ] = p;
         if( mwLFcur == MW_FREE_LIST ) mwLFcur = 0;
+        if( mwTimeOn ) mwTimeSample();
+        if( mwLeakOn && !( mwCounter & 63 ) && mwClockNs() >= mwLeakEnd ) mwLeakWindow();
 
         MW_MUTEX_UNLOCK();
         return;
@@ -1077,6 +4222,8 @@ check_dbl_free:
                 " freed from %s(%d)\n",
                 mwCounter, file, line, p,
                 mwLFfile[i], mwLFline[i] );
+            if( mwLFstack[i] ) mwStackPrint( mwLFstack[i] );
+            mwPROBE5( error, "double-free", p, file, line, mwCounter );
             
             MW_MUTEX_UNLOCK();
             return;
@@ -1086,6 +4233,7 @@ check_dbl_free:
     /* some weird pointer... block the free */
     mw_printf( "WILD free: <%ld> %s(%d), unknown pointer %p\n",
         mwCounter, file, line, p );
+    mwPROBE5( error, "wild-free", p, file, line, mwCounter );
     
     MW_MUTEX_UNLOCK();
     return;
@@ -1094,6 +4242,7 @@ check_dbl_free:
 void* mwCalloc( size_t a, size_t b, const char *file, int line ) {
     void *p;
     size_t size = a * b;
+    if( mwStackLevel ) mwStackNext = mwStackCapture( 1 );
     p = mwMalloc( size, file, line );
     if( p == NULL ) return NULL;
     memset( p, 0, size );
@@ -1415,6 +4564,10 @@ static void mwAutoInit( void )
     return;
 }
 static void mwUnlink( mwData* mw, const char* file, int line ) {
+    mwTabDel( mw );
+#ifdef MW_PTRHASH
+    mwPtrDel( mw );
+#endif
     if( mw->prev == NULL ) {
         if( mwHead != mw )
             mw_printf( "internal: <%ld> %s(%d), MW-%p: link1 NULL, but not head\n",
@@ -1757,6 +4910,7 @@ static int mwIsHeapOK( mwData *includes_mw ) {
 
 static int mwIsOwned( mwData* mw, const char *file, int line ) {
     int retv;
+    long i;
     mwStat *ms;
 
     /* see if the address is legal according to OS */
@@ -1766,6 +4920,14 @@ static int mwIsOwned( mwData* mw, const char *file, int line ) {
     if( mwHead == NULL && mwTail == NULL && mwStatCurAlloc == 0 )
         return 0;
 
+    /* with the block table, ownership is a lookup, and */
+    /* a damaged header can be restored from the table */
+    if( mwOOL ) {
+        i = mwTabFind( mw );
+        if( i < 0 ) return 0;
+        if( !mwTabIntact( i ) ) mwTabRestore( i, file, line );
+        }
+
     /* calculate checksum */
     if( mw->check != CHKVAL(mw) ) {
         /* may be damaged checksum, see if block is in heap */
@@ -1853,12 +5015,14 @@ static int mwTestBuf( mwData* mw, const char* file, int line ) {
     if( mwCheckOF( p ) ) {
         mw_printf( "underflow: <%ld> %s(%d), %ld bytes alloc'd at <%ld> %s(%d)\n",
             mwCounter,file,line, (long)mw->size, mw->count, mw->file, mw->line );
+        mwPROBE5( error, "underflow", p + mwOverflowZoneSize, mw->file, mw->line, mwCounter );
         retv = 1;
         }
     p += mwOverflowZoneSize + mw->size;
     if( mwIsReadAddr( p, mwOverflowZoneSize ) && mwCheckOF( p ) ) {
         mw_printf( "overflow: <%ld> %s(%d), %ld bytes alloc'd at <%ld> %s(%d)\n",
             mwCounter,file,line, (long)mw->size, mw->count, mw->file, mw->line );
+        mwPROBE5( error, "overflow", p - mw->size, mw->file, mw->line, mwCounter );
         retv = 1;
         }
 
@@ -1872,6 +5036,7 @@ static int mwTestBuf( mwData* mw, const char* file, int line ) {
 */
 static size_t mwFreeUp( size_t needed, int urgent ) {
     void *p;
+    long i;
     mwData *mw, *mw2;
     char *data;
 
@@ -1885,7 +5050,25 @@ static size_t mwFreeUp( size_t needed, int urgent ) {
         }
 
     /* free normal NML memory */
-    mw = mwHead;
+    for( i=0; mwOOL && i<mwTabUsed; ) {
+        if( !(mwTabFlag[i] & MW_NML) ) { i++; continue; }
+        mw = mwTabMW[i];
+        data = ((char*)mw)+mwDataSize+mwOverflowZoneSize;
+        if( mwTestMem( data, mwTabSize[i], MW_VAL_NML ) ) {
+            mw_printf( "wild pointer: <%ld> NoMansLand %p alloc'd at %s(%d)\n",
+                mwTabCount[i], data + mwOverflowZoneSize, mwTabFile[i], mwTabLine[i] );
+            }
+        mwNmlNumAlloc --;
+        mwNmlCurAlloc -= (long) mwTabSize[i];
+        MW_RELEASED( mwTabSize[i] );
+        mwUnlink( mw, "mwFreeUp", 0 ); /* moves the last entry into slot i */
+        free( mw );
+        p = malloc( needed );
+        if( p == NULL ) continue;
+        free( p );
+        return needed;
+        }
+    mw = mwOOL ? NULL : mwHead;
     while( mw != NULL ) {
         if( !(mw->flag & MW_NML) ) mw = mw->next;
         else {
@@ -1895,7 +5078,10 @@ static size_t mwFreeUp( size_t needed, int urgent ) {
                     mw->count, data + mwOverflowZoneSize, mw->file, mw->line );
                 }
             mw2 = mw->next;
+            mwNmlNumAlloc --;
+            mwNmlCurAlloc -= (long) mw->size;
             mwUnlink( mw, "mwFreeUp", 0 );
+            MW_RELEASED( mw->size );
             free( mw );
             mw = mw2;
             p = malloc( needed );
@@ -1939,10 +5125,415 @@ static int mwStrCmpI( const char *s1, const char *s2 ) {
     return 0;
     }
 
+#define mwMARKHASH(p) ((unsigned)(((unsigned long)(p)>>4)^((unsigned long)(p)>>13)) & (MW_MARK_HASH-1))
+
+static mwMarker* mwMarkFind( void *p, unsigned *bucket ) {
+    mwMarker *mrk;
+    *bucket = mwMARKHASH(p);
+    for( mrk=mwMarkTable[*bucket]; mrk; mrk=mrk->hnext )
+        if( mrk->host == p ) break;
+    return mrk;
+    }
+
+static mwMarkSite* mwMarkIntern( const char *text ) {
+    mwMarkSite *site;
+    unsigned hash = 0;
+    const char *s;
+    size_t len;
+
+    for( s=text; *s; s++ ) hash = hash * 31 + (unsigned char) *s;
+    for( site=mwMarkSites[hash&(MW_MARK_HASH-1)]; site; site=site->next )
+        if( site->hash == hash && !strcmp( site->text, text ) ) return site;
+
+    len = (size_t)(s - text);
+    site = (mwMarkSite*) malloc( sizeof(mwMarkSite) + len );
+    if( site == NULL ) return NULL;
+    memcpy( site->text, text, len+1 );
+    site->hash = hash;
+    site->next = mwMarkSites[hash&(MW_MARK_HASH-1)];
+    mwMarkSites[hash&(MW_MARK_HASH-1)] = site;
+    return site;
+    }
+
+/* reports and releases all markers and interned descriptions */
+static void mwMarkReport( void ) {
+    mwMarker *mrk;
+    mwMarkRef *ref;
+    mwMarkSite *site;
+    size_t len;
+    char *buf;
+    int i;
+
+    while( mwFirstMark ) {
+        mrk = mwFirstMark;
+        for( len=0, ref=mrk->first; ref; ref=ref->next )
+            len += strlen( ref->site->text ) + 2;
+        buf = (char*) malloc( len+1 );
+        if( buf != NULL ) {
+            for( len=0, ref=mrk->first; ref; ref=ref->next ) {
+                if( ref != mrk->first ) { memcpy( buf+len, ", ", 2 ); len += 2; }
+                strcpy( buf+len, ref->site->text );
+                len += strlen( buf+len );
+                }
+            buf[len] = 0;
+            mw_printf( "mark: %p: %s\n", mrk->host, buf );
+            free( buf );
+            }
+        else mw_printf( "mark: %p: %s\n", mrk->host, mrk->first->site->text );
+        while( mrk->first ) {
+            ref = mrk->first->next;
+            free( mrk->first );
+            mrk->first = ref;
+            }
+        mwFirstMark = mrk->next;
+        free( mrk );
+        mwErrors ++;
+        }
+
+    for( i=0; i<MW_MARK_HASH; i++ ) {
+        mwMarkTable[i] = NULL;
+        while( mwMarkSites[i] ) {
+            site = mwMarkSites[i]->next;
+            free( mwMarkSites[i] );
+            mwMarkSites[i] = site;
+            }
+        }
+    }
+
+/* monotonic time in nanoseconds */
+static mwQWORD mwClockNs( void ) {
+#if defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    if( clock_gettime( CLOCK_MONOTONIC, &ts ) == 0 )
+        return (mwQWORD) ts.tv_sec * 1000000000UL + (mwQWORD) ts.tv_nsec;
+#endif
+    return (mwQWORD) clock() * ( 1000000000UL / CLOCKS_PER_SEC );
+    }
+
+/* small number identifying the calling thread, starting at 1 */
+static unsigned mwThreadNum( void ) {
+    if( mwThisThread == 0 )
+        mwThisThread = mwATOMIC_ADD( &mwThreadCount, 1 ) + 1;
+    return mwThisThread;
+    }
+
+#define mwSITEHASH(f,l) ((unsigned)(((unsigned long)(f)>>3)^((unsigned long)(l)*2654435761UL)) & (MW_SITE_HASH-1))
+
+/* finds or creates the site record for file and line */
+static mwSite* mwSiteGet( const char *file, int line ) {
+    mwSite *site;
+    unsigned h = mwSITEHASH(file,line);
+
+    for( site=mwSiteTable[h]; site; site=site->next )
+        if( site->file == file && site->line == line ) return site;
+
+    site = (mwSite*) malloc( sizeof(mwSite) );
+    if( site == NULL ) return NULL;
+    site->file = file;
+    site->line = line;
+    site->id = ++ mwSiteCount;
+    site->gen = 0;
+    site->skip = -1;
+    site->mod = site->stat = NULL;
+    site->life = NULL;
+    site->grow = NULL;
+    site->churn = NULL;
+    site->leak = NULL;
+    site->unfreed = NULL;
+    site->peakgen = 0;
+    site->qgen = site->quota = 0;
+    site->livebytes = site->liveblocks = 0;
+    site->next = mwSiteTable[h];
+    mwSiteTable[h] = site;
+    return site;
+    }
+
+/* the sites 'want' picks, sorted by 'order'; NULL if none or memory is low */
+static mwSite** mwSiteList( int (*want)( mwSite *site ), int (*order)( const void *a, const void *b ), long *count ) {
+    mwSite *site, **list;
+    long n = 0, i;
+
+    for( i=0; i<MW_SITE_HASH; i++ )
+        for( site=mwSiteTable[i]; site; site=site->next )
+            if( (*want)( site ) ) n ++;
+    *count = n;
+    if( n == 0 ) return NULL;
+    list = (mwSite**) malloc( n * sizeof(mwSite*) );
+    if( list == NULL ) return NULL;
+    for( n=0, i=0; i<MW_SITE_HASH; i++ )
+        for( site=mwSiteTable[i]; site; site=site->next )
+            if( (*want)( site ) ) list[n++] = site;
+    qsort( list, n, sizeof(mwSite*), order );
+    return list;
+    }
+
+/* 'file(line)' for the report tables, keeping the end of long file names */
+static const char* mwSiteName( char *buf, const char *file, int line ) {
+    int len;
+
+    if( file == NULL || !mwIsReadAddr( file, 1 ) ) file = "<unknown>";
+    len = (int) strlen( file );
+    if( len > 34 ) file += len - 34;
+    sprintf( buf, "%s(%d)", file, line );
+    return buf;
+    }
+
+/***********************************************************************
+** Out-of-line block table
+**
+** When enabled with mwOutOfLine(), a copy of each block's metadata is
+** kept in contiguous arrays, in no particular order. Checks sweep the
+** arrays instead of following the heap chain, and trust the table over
+** the mwData header, which a buffer underflow can overwrite. mw->slot
+** is a hint to where the block's entry is; it's verified before use.
+***********************************************************************/
+
+static int mwTabGrow( void ) {
+    long n;
+    size_t per;
+    char *blk;
+
+    n = mwTabMax ? mwTabMax * 2 : 1024;
+    per = sizeof(mwData*) + sizeof(size_t) + sizeof(const char*) +
+        sizeof(long) + sizeof(int) + sizeof(unsigned);
+    blk = (char*) malloc( per * (size_t) n );
+    if( blk == NULL ) return 0;
+
+    /* widest types first, so every array is aligned */
+    memcpy( blk, mwTabMW, sizeof(mwData*) * (size_t) mwTabUsed );
+    blk += sizeof(mwData*) * (size_t) n;
+    memcpy( blk, mwTabSize, sizeof(size_t) * (size_t) mwTabUsed );
+    mwTabSize = (size_t*)(void*) blk;
+    blk += sizeof(size_t) * (size_t) n;
+    memcpy( blk, mwTabFile, sizeof(const char*) * (size_t) mwTabUsed );
+    mwTabFile = (const char**)(void*) blk;
+    blk += sizeof(const char*) * (size_t) n;
+    memcpy( blk, mwTabCount, sizeof(long) * (size_t) mwTabUsed );
+    mwTabCount = (long*)(void*) blk;
+    blk += sizeof(long) * (size_t) n;
+    memcpy( blk, mwTabLine, sizeof(int) * (size_t) mwTabUsed );
+    mwTabLine = (int*)(void*) blk;
+    blk += sizeof(int) * (size_t) n;
+    memcpy( blk, mwTabFlag, sizeof(unsigned) * (size_t) mwTabUsed );
+    mwTabFlag = (unsigned*)(void*) blk;
+    blk += sizeof(unsigned) * (size_t) n;
+
+    free( mwTabMW );
+    mwTabMW = (mwData**)(void*)( blk - per * (size_t) n );
+    mwTabMax = n;
+    return 1;
+    }
+
+static void mwTabAdd( mwData *mw ) {
+    long i;
+    mw->slot = -1L;
+    if( !mwOOL ) return;
+    if( mwTabUsed >= mwTabMax && !mwTabGrow() ) {
+        mw_printf( "internal: memory low, block table disabled\n" );
+        mwOOL = 0;
+        return;
+        }
+    i = mwTabUsed ++;
+    mwTabMW[i] = mw;
+    mwTabSize[i] = mw->size;
+    mwTabFile[i] = mw->file;
+    mwTabLine[i] = mw->line;
+    mwTabCount[i] = mw->count;
+    mwTabFlag[i] = mw->flag;
+    mw->slot = i;
+    }
+
+static long mwTabFind( mwData *mw ) {
+    long i;
+    i = mw->slot;
+    if( i >= 0 && i < mwTabUsed && mwTabMW[i] == mw ) return i;
+    for( i=0; i<mwTabUsed; i++ )
+        if( mwTabMW[i] == mw ) return i;
+    return -1L;
+    }
+
+static void mwTabDel( mwData *mw ) {
+    long i, last;
+    if( !mwOOL ) return;
+    i = mwTabFind( mw );
+    if( i < 0 ) return;
+    last = -- mwTabUsed;
+    if( i != last ) {
+        mwTabMW[i] = mwTabMW[last];
+        mwTabSize[i] = mwTabSize[last];
+        mwTabFile[i] = mwTabFile[last];
+        mwTabLine[i] = mwTabLine[last];
+        mwTabCount[i] = mwTabCount[last];
+        mwTabFlag[i] = mwTabFlag[last];
+        mwTabMW[i]->slot = i;
+        }
+    }
+
+#ifdef MW_PTRHASH
+/*
+** The pointer hash is open addressed, with tombstones for removed
+** blocks. It has its own spin lock, since mwOwned() is used by the
+** preload library's free() after memwatch has terminated too. Room
+** is made before a block is allocated, so entering it can't fail.
+*/
+#define mwPTRSLOT(mw)   ((long)( ( (unsigned long)(size_t)(mw) >> 4 ) * 2654435761UL ) & ( mwPtrMax - 1 ))
+
+static void mwPtrLock( void ) {
+    while( !mwCAS( &mwPtrBusy, 0, 1 ) ) ;
+    mwBARRIER();
+    }
+
+static void mwPtrUnlock( void ) {
+    mwBARRIER();
+    mwPtrBusy = 0;
+    }
+
+static int mwPtrRoom( void ) {
+    mwData **old = mwPtrHash, **hash;
+    long i, j, max = mwPtrMax, n;
+
+    if( ( mwPtrUsed + 1 ) * 2 <= mwPtrMax ) return 1;
+    n = 1024;
+    while( n < ( mwPtrLive + 1 ) * 4 ) n *= 2;
+    hash = (mwData**) calloc( (size_t) n, sizeof(mwData*) );
+    if( hash == NULL ) return 0;
+    mwPtrLock();
+    mwPtrHash = hash;
+    mwPtrMax = n;
+    mwPtrUsed = mwPtrLive;
+    for( i=0; i<max; i++ ) {
+        if( old[i] == NULL || old[i] == MW_PTR_GONE ) continue;
+        for( j=mwPTRSLOT(old[i]); hash[j]; j=(j+1)&(n-1) ) ;
+        hash[j] = old[i];
+        }
+    mwPtrUnlock();
+    free( old );
+    return 1;
+    }
+
+static void mwPtrAdd( mwData *mw ) {
+    long i;
+    mwPtrLock();
+    for( i=mwPTRSLOT(mw); mwPtrHash[i]; i=(i+1)&(mwPtrMax-1) ) ;
+    mwPtrHash[i] = mw;
+    mwPtrUsed ++;
+    mwPtrLive ++;
+    mwPtrUnlock();
+    }
+
+static void mwPtrDel( mwData *mw ) {
+    long i;
+    mwPtrLock();
+    if( mwPtrMax ) {
+        for( i=mwPTRSLOT(mw); mwPtrHash[i]; i=(i+1)&(mwPtrMax-1) ) {
+            if( mwPtrHash[i] == mw ) {
+                mwPtrHash[i] = MW_PTR_GONE;
+                mwPtrLive --;
+                break;
+                }
+            }
+        }
+    mwPtrUnlock();
+    }
+
+static int mwPtrFind( mwData *mw ) {
+    long i;
+    int found = 0;
+    mwPtrLock();
+    if( mwPtrMax ) {
+        for( i=mwPTRSLOT(mw); mwPtrHash[i]; i=(i+1)&(mwPtrMax-1) ) {
+            if( mwPtrHash[i] == mw ) { found = 1; break; }
+            }
+        }
+    mwPtrUnlock();
+    return found;
+    }
+#endif /* MW_PTRHASH */
+
+static void mwTabUpdate( mwData *mw ) {
+    long i;
+    if( !mwOOL ) return;
+    i = mwTabFind( mw );
+    if( i < 0 ) return;
+    mwTabSize[i] = mw->size;
+    mwTabFlag[i] = mw->flag;
+    }
+
+/* returns nonzero if the header of the block in slot 'i' matches the table */
+static int mwTabIntact( long i ) {
+    mwData *mw = mwTabMW[i];
+    return mw->check == CHKVAL(mw) && mw->size == mwTabSize[i] &&
+        mw->file == mwTabFile[i] && mw->line == mwTabLine[i] &&
+        mw->count == mwTabCount[i] && mw->flag == mwTabFlag[i];
+    }
+
+static void mwTabRestore( long i, const char *file, int line ) {
+    mwData *mw = mwTabMW[i];
+    long j, prev = -1L, next = -1L;
+    mw_printf( "internal: <%ld> %s(%d), MW-%p header damaged, restored from block table\n",
+        mwCounter, file ? file : "unknown", line, mw );
+    mw->size = mwTabSize[i];
+    mw->file = mwTabFile[i];
+    mw->line = mwTabLine[i];
+    mw->count = mwTabCount[i];
+    mw->flag = mwTabFlag[i];
+    mw->slot = i;
+    mw->check = CHKVAL(mw);
+
+    /* new blocks go first in the chain, so it runs newest to oldest; */
+    /* the links are the blocks allocated just after and just before */
+    for( j=0; j<mwTabUsed; j++ ) {
+        if( mwTabCount[j] > mwTabCount[i] && ( prev < 0 || mwTabCount[j] < mwTabCount[prev] ) ) prev = j;
+        if( mwTabCount[j] < mwTabCount[i] && ( next < 0 || mwTabCount[j] > mwTabCount[next] ) ) next = j;
+        }
+    mw->prev = prev < 0 ? NULL : mwTabMW[prev];
+    mw->next = next < 0 ? NULL : mwTabMW[next];
+    if( mw->prev == NULL ) mwHead = mw;
+    else mw->prev->next = mw;
+    if( mw->next == NULL ) mwTail = mw;
+    else mw->next->prev = mw;
+    }
+
+/*
+** mwTabTest:
+**  Like mwTestBuf(), but for the block in table slot 'i'.
+**  Only the guard bytes are read from the block itself.
+*/
+static int mwTabTest( long i, const char *file, int line ) {
+    int retv = 0;
+    char *p;
+
+    if( file == NULL ) file = "unknown";
+
+    /* the header shares a cache line with the guard, so this is cheap */
+    if( !mwTabIntact( i ) ) {
+        mwTabRestore( i, file, line );
+        retv = 1;
+        }
+
+    p = ((char*)mwTabMW[i]) + mwDataSize;
+    if( mwCheckOF( p ) ) {
+        mw_printf( "underflow: <%ld> %s(%d), %ld bytes alloc'd at <%ld> %s(%d)\n",
+            mwCounter,file,line, (long)mwTabSize[i], mwTabCount[i], mwTabFile[i], mwTabLine[i] );
+        mwPROBE5( error, "underflow", p + mwOverflowZoneSize, mwTabFile[i], mwTabLine[i], mwCounter );
+        retv = 1;
+        }
+    p += mwOverflowZoneSize + mwTabSize[i];
+    if( mwCheckOF( p ) ) {
+        mw_printf( "overflow: <%ld> %s(%d), %ld bytes alloc'd at <%ld> %s(%d)\n",
+            mwCounter,file,line, (long)mwTabSize[i], mwTabCount[i], mwTabFile[i], mwTabLine[i] );
+        mwPROBE5( error, "overflow", p - mwTabSize[i], mwTabFile[i], mwTabLine[i], mwCounter );
+        retv = 1;
+        }
+
+    return retv;
+    }
+
 #define AIPH() if( always_invoked ) { mw_printf("autocheck: <%ld> %s(%d) ", mwCounter, file, line ); always_invoked = 0; }
 
 static int mwTestNow( const char *file, int line, int always_invoked ) {
     int retv = 0;
+    long i;
     mwData *mw;
     char *data;
 
@@ -1954,6 +5545,12 @@ static int mwTestNow( const char *file, int line, int always_invoked ) {
             (mwTestFlags & MW_TEST_NML) ? "nomansland ": ""
             );
 
+    /* with the block table, restore damaged headers before walking the chain */
+    if( ( mwTestFlags & MW_TEST_ALLOC ) && mwOOL ) {
+        for( i=0; i<mwTabUsed; i++ ) {
+            if( mwTabTest( i, file, line ) ) retv ++;
+            }
+        }
     if( mwTestFlags & MW_TEST_CHAIN ) {
         for( mw = mwHead; mw; mw=mw->next ) {
             if( !mwIsSafeAddr(mw, mwDataSize) ) {
@@ -1992,13 +5589,23 @@ static int mwTestNow( const char *file, int line, int always_invoked ) {
                 }
             }
         }
-    if( mwTestFlags & MW_TEST_ALLOC ) {
+    if( ( mwTestFlags & MW_TEST_ALLOC ) && !mwOOL ) {
         for( mw = mwHead; mw; mw=mw->next ) {
             if( mwTestBuf( mw, file, line ) ) retv ++;
             }
         }
     if( mwTestFlags & MW_TEST_NML ) {
-        for( mw = mwHead; mw; mw=mw->next ) {
+        if( mwOOL ) {
+            for( i=0; i<mwTabUsed; i++ ) {
+                if( !(mwTabFlag[i] & MW_NML) ) continue;
+                data = ((char*)mwTabMW[i])+mwDataSize+mwOverflowZoneSize;
+                if( mwTestMem( data, mwTabSize[i], MW_VAL_NML ) ) {
+                    mw_printf( "wild pointer: <%ld> NoMansLand %p alloc'd at %s(%d)\n",
+                        mwTabCount[i], data + mwOverflowZoneSize, mwTabFile[i], mwTabLine[i] );
+                    }
+                }
+            }
+        else for( mw = mwHead; mw; mw=mw->next ) {
             if( (mw->flag & MW_NML) ) {
                 data = ((char*)mw)+mwDataSize+mwOverflowZoneSize;
                 if( mwTestMem( data, mw->size, MW_VAL_NML ) ) {
@@ -2013,6 +5620,9 @@ static int mwTestNow( const char *file, int line, int always_invoked ) {
     if( file && !always_invoked && !retv )
         mw_printf("check: <%ld> %s(%d), complete; no errors\n",
             mwCounter, file, line );
+    if( ( mwRecFile || mwFlight ) && !always_invoked )
+        mwEvent( MWT_CHECK, file, line, (size_t) retv, NULL, NULL, 0, 0 );
+    mwPROBE4( check, retv, file, line, mwCounter );
     return retv;
     }
 
@@ -2024,7 +5634,8 @@ static void mwStatReport()
 {
     mwStat* ms, *ms2;
     const char *modname;
-    int modnamelen;
+    char range[48];
+    int modnamelen, i;
 
     /* global statistics report */
     mw_printf( "\nMemory usage statistics (global):\n" );
@@ -2032,7 +5643,33 @@ static void mwStatReport()
     mw_printf( " L)argest memory usage      : %ld\n", mwStatMaxAlloc );
     mw_printf( " T)otal of all alloc() calls: %ld\n", mwStatTotAlloc );
     mw_printf( " U)nfreed bytes totals      : %ld\n", mwStatCurAlloc );
-    
+    if( mwStatNumRealloc ) {
+        mw_printf( " R)ealloc() calls made      : %ld\n", mwStatNumRealloc );
+        mw_printf( " C)opied by realloc()       : %ld\n", mwStatCopied );
+        }
+
+    mw_printf( "\nAllocation sizes (global):\n" );
+    mw_printf( " Size                  Allocations Unfreed\n" );
+    for( i=0; i<MW_HIST_CLASSES; i++ ) {
+        if( mwHistAlloc[i] == 0 ) continue;
+        if( i == MW_HIST_CLASSES - 1 ) sprintf( range, "%lu+", (unsigned long) mwSizeClassMin( i ) );
+        else sprintf( range, "%lu-%lu", (unsigned long) mwSizeClassMin( i ), (unsigned long) mwSizeClassMin( i + 1 ) - 1 );
+        mw_printf( " %-21s %-11ld %ld\n", range, mwHistAlloc[i], mwHistLive[i] );
+        }
+    mwStackReport();
+    mwLifeReport();
+    mwGrowReport();
+    mwChurnReport();
+    mwPeakReport();
+    if( mwTimeUsed ) mwTimeChart( NULL );
+    mwMemReport();
+    if( mwLeakWindows ) mwLeakReport( "Leak suspects" );
+    if( mwThreadOn ) mwThreadReport();
+    if( mwTagCount ) mwTagReport();
+    if( mwQuotaCount ) mwQuotaReport();
+    if( mwScopeCount )
+        mw_printf( "\nScopes: %u begun, %ld ended with %ld bytes in %ld blocks surviving\n",
+            mwScopeCount, mwScopeLeaky, mwScopeBytes, mwScopeBlocks );
 
     if( mwStatLevel < 1 ) return;
 
@@ -2066,8 +5703,67 @@ static void mwStatReport()
             }
         }
     }
+
+    /* size distributions, as percentiles of the allocation sizes */
+    mw_printf( "\nAllocation sizes (detailed):\n");
+    mw_printf( " Module/Line                                Median   90%%      99%%      Commonest\n");
+    for( ms=mwStatList; ms; ms=ms->next )
+    {
+        if( ms->line != -1 || ms->hist == NULL ) continue;
+        if( ms->file == NULL || !mwIsReadAddr(ms->file,22) ) modname = "<unknown>";
+        else modname = ms->file;
+        modnamelen = strlen(modname);
+        if( modnamelen > 42 ) modname = modname + modnamelen - 42;
+        mwHistReport( modname, ms->hist );
+        if( ms->file && mwStatLevel > 1 )
+        {
+            for( ms2=mwStatList; ms2; ms2=ms2->next )
+            {
+                if( ms2->line!=-1 && ms2->file!=NULL && ms2->hist && !mwStrCmpI( ms2->file, ms->file ) )
+                {
+                    sprintf( range, " %d", ms2->line );
+                    mwHistReport( range, ms2->hist );
+                }
+            }
+        }
+    }
 }
 
+/*
+** Finds the median, 90th and 99th percentile of a size histogram, as
+** the top of the class each falls in. Returns the number counted.
+*/
+static long mwHistPct( const long *hist, unsigned long *pct ) {
+    long total = 0, seen = 0;
+    int i, p = 0;
+    static const int want[3] = { 50, 90, 99 };
+
+    for( i=0; i<MW_HIST_CLASSES; i++ ) total += hist[i];
+    if( total == 0 ) return 0;
+    for( i=0; i<MW_HIST_CLASSES && p<3; i++ ) {
+        seen += hist[i];
+        while( p < 3 && seen * 100 >= total * want[p] )
+            pct[p++] = i < MW_HIST_CLASSES - 1 ? (unsigned long) mwSizeClassMin( i + 1 ) - 1 :
+                (unsigned long) mwSizeClassMin( i );
+        }
+    return total;
+    }
+
+/* writes one line of mwStatReport()'s size distribution table */
+static void mwHistReport( const char *name, const long *hist ) {
+    long most = 0;
+    unsigned long pct[3];
+    int i, common = 0;
+
+    if( mwHistPct( hist, pct ) == 0 ) return;
+    for( i=0; i<MW_HIST_CLASSES; i++ )
+        if( hist[i] > most ) { most = hist[i]; common = i; }
+    mw_printf( " %-42s %-8lu %-8lu %-8lu %lu-%lu\n", name, pct[0], pct[1], pct[2],
+        (unsigned long) mwSizeClassMin( common ),
+        common < MW_HIST_CLASSES - 1 ? (unsigned long) mwSizeClassMin( common + 1 ) - 1 :
+            (unsigned long) mwSizeClassMin( common ) );
+    }
+
 static mwStat* mwStatGet( const char *file, int line, int makenew ) {
     mwStat* ms;
 
@@ -2095,6 +5791,7 @@ static mwStat* mwStatGet( const char *file, int line, int makenew ) {
             return NULL;
             }
         }
+    ms->hist = (long*) calloc( MW_HIST_CLASSES * 2, sizeof(long) );
     ms->file = file;
     ms->line = line;
     ms->total = 0L;
@@ -2108,24 +5805,33 @@ static mwStat* mwStatGet( const char *file, int line, int makenew ) {
 
 static void mwStatAlloc( size_t size, const char* file, int line ) {
     mwStat* ms;
+    mwSite* site;
+    int i = mwSizeClass( size );
+
+    /* the site registry caches the lookups, which compare file names */
+    site = mwSiteGet( file, line );
 
     /* update the module statistics */
-    ms = mwStatGet( file, -1, 1 );
+    if( site == NULL ) ms = mwStatGet( file, -1, 1 );
+    else if( ( ms = site->mod ) == NULL ) ms = site->mod = mwStatGet( file, -1, 1 );
     if( ms != NULL ) {
         ms->total += (long) size;
         ms->curr += (long) size;
         ms->num ++;
         if( ms->curr > ms->max ) ms->max = ms->curr;
+        if( ms->hist ) { ms->hist[i] ++; ms->hist[MW_HIST_CLASSES+i] ++; }
         }
 
     /* update the line statistics */
     if( mwStatLevel > 1 && line != -1 && file ) {
-        ms = mwStatGet( file, line, 1 );
+        if( site == NULL ) ms = mwStatGet( file, line, 1 );
+        else if( ( ms = site->stat ) == NULL ) ms = site->stat = mwStatGet( file, line, 1 );
         if( ms != NULL ) {
             ms->total += (long) size;
             ms->curr += (long) size;
             ms->num ++;
             if( ms->curr > ms->max ) ms->max = ms->curr;
+            if( ms->hist ) { ms->hist[i] ++; ms->hist[MW_HIST_CLASSES+i] ++; }
             }
         }
 
@@ -2133,16 +5839,75 @@ static void mwStatAlloc( size_t size, const char* file, int line ) {
 
 static void mwStatFree( size_t size, const char* file, int line ) {
     mwStat* ms;
+    mwSite* site;
+    int i = mwSizeClass( size );
+
+    site = mwSiteGet( file, line );
 
     /* update the module statistics */
-    ms = mwStatGet( file, -1, 1 );
-    if( ms != NULL ) ms->curr -= (long) size;
+    if( site == NULL ) ms = mwStatGet( file, -1, 1 );
+    else if( ( ms = site->mod ) == NULL ) ms = site->mod = mwStatGet( file, -1, 1 );
+    if( ms != NULL ) {
+        ms->curr -= (long) size;
+        if( ms->hist ) ms->hist[MW_HIST_CLASSES+i] --;
+        }
 
     /* update the line statistics */
     if( mwStatLevel > 1 && line != -1 && file ) {
-        ms = mwStatGet( file, line, 1 );
-        if( ms != NULL ) ms->curr -= (long) size;
+        if( site == NULL ) ms = mwStatGet( file, line, 1 );
+        else if( ( ms = site->stat ) == NULL ) ms = site->stat = mwStatGet( file, line, 1 );
+        if( ms != NULL ) {
+            ms->curr -= (long) size;
+            if( ms->hist ) ms->hist[MW_HIST_CLASSES+i] --;
+            }
+        }
+    }
+
+/*
+** Size classes are log-linear: sizes below 2^MW_HIST_BITS get a class
+** each, and every power of two above is split in 2^MW_HIST_BITS equal
+** parts. The last class holds everything larger.
+*/
+static int mwSizeClass( size_t size ) {
+    int e, cls;
+    if( size < ( 1U << MW_HIST_BITS ) ) return (int) size;
+#if defined(__GNUC__)
+    e = (int)( sizeof(unsigned long long) * 8 - 1 ) - __builtin_clzll( (unsigned long long) size );
+#else
+    for( e=MW_HIST_BITS; e < (int)( sizeof(size_t) * 8 - 1 ) && ( size >> ( e + 1 ) ); e++ ) ;
+#endif
+    e -= MW_HIST_BITS;
+    cls = ( ( e + 1 ) << MW_HIST_BITS ) + (int)( size >> e ) - ( 1 << MW_HIST_BITS );
+    return cls < MW_HIST_CLASSES ? cls : MW_HIST_CLASSES - 1;
+    }
+
+size_t mwSizeClassMin( int cls ) {
+    int e;
+    if( cls < 0 ) return 0;
+    if( cls >= MW_HIST_CLASSES ) cls = MW_HIST_CLASSES - 1;
+    if( cls < ( 1 << MW_HIST_BITS ) ) return (size_t) cls;
+    e = ( cls >> MW_HIST_BITS ) - 1;
+    return (size_t)( ( 1 << MW_HIST_BITS ) + ( cls & ( ( 1 << MW_HIST_BITS ) - 1 ) ) ) << e;
+    }
+
+int mwSizeHistogram( const char *file, int line, int live, long *counts ) {
+    mwStat *ms;
+    const long *hist;
+
+    mwAutoInit();
+    MW_MUTEX_LOCK();
+    if( file == NULL ) hist = live ? mwHistLive : mwHistAlloc;
+    else {
+        ms = mwStatGet( file, line, 0 );
+        if( ms == NULL || ms->hist == NULL ) {
+            MW_MUTEX_UNLOCK();
+            return 0;
+            }
+        hist = ms->hist + ( live ? MW_HIST_CLASSES : 0 );
         }
+    memcpy( counts, hist, MW_HIST_CLASSES * sizeof(long) );
+    MW_MUTEX_UNLOCK();
+    return 1;
     }
 
 /***********************************************************************
@@ -2180,6 +5945,181 @@ int mwIsSafeAddr( void *p, unsigned len )
 #endif /* WIN32 */
 #endif /* MW_SAFEADDR */
 
+#ifdef MW_HAVE_MAPS
+#define MW_SAFEADDR
+
+/*
+** Linux: answer from a cached copy of /proc/self/maps.
+** Lookups are a binary search and never touch the memory being
+** asked about. The table is reread when an address isn't found in it,
+** or after memwatch has released a block large enough that libc may
+** have unmapped it. Readers don't lock; they retry if a rebuild was
+** in progress (mwMapsGen is odd while the table is being written).
+** When the process has more ranges than fit, the table is doubled;
+** the old one is never freed, as a reader may still be in it. If the
+** table can't grow, addresses it doesn't cover are taken as readable,
+** which is what the probe did before there was a table.
+*/
+
+#define MW_MAP_READ     1
+#define MW_MAP_WRITE    2
+
+typedef struct mwMapRange_ mwMapRange;
+struct mwMapRange_ {
+    unsigned long   lo;     /* first address of the range */
+    unsigned long   hi;     /* first address after the range */
+    int             prot;   /* MW_MAP_xxx bits */
+    };
+
+static mwMapRange   mwMapsFirst[MW_MAPS_MAX];
+static mwMapRange*  mwMaps = mwMapsFirst;
+static int          mwMapsMax = MW_MAPS_MAX;
+static int          mwMapsCount = 0;
+static int          mwMapsFull = 0;     /* ranges were left out */
+static volatile unsigned long mwMapsGen = 0;
+static volatile int mwMapsBusy = 0;
+static char         mwMapsBuf[4096];
+
+static unsigned long mwMapsHex( const char **pp ) {
+    unsigned long v = 0;
+    const char *p = *pp;
+    for(;;p++) {
+        if( *p >= '0' && *p <= '9' ) v = (v<<4) | (unsigned long)(*p-'0');
+        else if( *p >= 'a' && *p <= 'f' ) v = (v<<4) | (unsigned long)(*p-'a'+10);
+        else break;
+        }
+    *pp = p;
+    return v;
+    }
+
+/* parses one "lo-hi perms ..." line into the table */
+static void mwMapsLine( const char *p ) {
+    unsigned long lo, hi;
+    int prot = 0;
+    mwMapRange *r;
+
+    lo = mwMapsHex( &p );
+    if( *p++ != '-' ) return;
+    hi = mwMapsHex( &p );
+    if( *p++ != ' ' ) return;
+    if( p[0] == 'r' ) prot |= MW_MAP_READ;
+    if( p[1] == 'w' ) prot |= MW_MAP_WRITE;
+    if( !prot || hi <= lo ) return;
+
+    /* merge with the previous range if they touch */
+    if( mwMapsCount > 0 ) {
+        r = &mwMaps[mwMapsCount-1];
+        if( r->hi == lo && r->prot == prot ) { r->hi = hi; return; }
+        }
+    if( mwMapsCount >= mwMapsMax ) {
+        mwMapsFull = 1;
+        return;
+        }
+    r = &mwMaps[mwMapsCount++];
+    r->lo = lo;
+    r->hi = hi;
+    r->prot = prot;
+    }
+
+static void mwMapsRefresh( void ) {
+    mwMapRange *more;
+    int fd, n, have, used;
+    char *nl;
+
+    /* only one rebuilder; others wait for it to finish */
+    if( __sync_lock_test_and_set( &mwMapsBusy, 1 ) ) {
+        while( mwMapsBusy ) mwBARRIER();
+        return;
+        }
+
+    mwMapsGen ++;
+    mwBARRIER();
+    mwMapsStale = 0;
+again:
+    mwMapsCount = 0;
+    mwMapsFull = 0;
+    fd = open( "/proc/self/maps", O_RDONLY );
+    if( fd >= 0 ) {
+        have = 0;
+        while( (n = (int) read( fd, mwMapsBuf+have, sizeof(mwMapsBuf)-1-have )) > 0 ) {
+            have += n;
+            mwMapsBuf[have] = 0;
+            used = 0;
+            while( (nl = strchr( mwMapsBuf+used, '\n' )) != NULL ) {
+                *nl = 0;
+                mwMapsLine( mwMapsBuf+used );
+                used = (int)(nl - mwMapsBuf) + 1;
+                }
+            /* keep the partial line; lines longer than the buffer are dropped */
+            if( used == 0 && have == (int)sizeof(mwMapsBuf)-1 ) have = 0;
+            have -= used;
+            memmove( mwMapsBuf, mwMapsBuf+used, (size_t) have );
+            }
+        close( fd );
+        }
+    if( mwMapsFull ) {
+        more = (mwMapRange*) malloc( sizeof(mwMapRange) * (size_t) mwMapsMax * 2 );
+        if( more != NULL ) {
+            mwMaps = more;
+            mwMapsMax *= 2;
+            goto again;
+            }
+        }
+    mwBARRIER();
+    mwMapsGen ++;
+    __sync_lock_release( &mwMapsBusy );
+    }
+
+/* returns nonzero if all of [lo,hi) is mapped with 'prot' */
+static int mwMapsCheck( unsigned long lo, unsigned long hi, int prot ) {
+    unsigned long gen;
+    int a, b, m, ok;
+
+    do {
+        while( (gen = mwMapsGen) & 1 ) mwBARRIER();
+        mwBARRIER();
+        ok = 0;
+        a = 0; b = mwMapsCount;
+        while( a < b ) {
+            m = (a+b) / 2;
+            if( mwMaps[m].hi <= lo ) a = m+1;
+            else b = m;
+            }
+        for( ; a < mwMapsCount && mwMaps[a].lo <= lo; a++ ) {
+            if( (mwMaps[a].prot & prot) != prot ) break;
+            if( mwMaps[a].hi >= hi ) { ok = 1; break; }
+            lo = mwMaps[a].hi;
+            }
+        mwBARRIER();
+        } while( gen != mwMapsGen );
+    return ok;
+    }
+
+static int mwMapsQuery( const void *p, unsigned len, int prot ) {
+    unsigned long lo = (unsigned long) p;
+    unsigned long hi = lo + len;
+
+    if( p == NULL ) return 0;
+    if( !len ) return 1;
+    if( hi < lo ) return 0;
+    if( mwMapsStale ) mwMapsRefresh();
+    if( mwMapsCheck( lo, hi, prot ) ) return 1;
+    mwMapsRefresh();
+    if( mwMapsCheck( lo, hi, prot ) ) return 1;
+    return mwMapsFull && lo >= mwMaps[mwMapsCount-1].hi;
+    }
+
+int mwIsReadAddr( const void *p, unsigned len )
+{
+    return mwMapsQuery( p, len, MW_MAP_READ );
+}
+
+int mwIsSafeAddr( void *p, unsigned len )
+{
+    return mwMapsQuery( p, len, MW_MAP_READ|MW_MAP_WRITE );
+}
+#endif /* MW_HAVE_MAPS */
+
 #ifndef MW_SAFEADDR
 #ifdef SIGSEGV
 #define MW_SAFEADDR
@@ -2324,7 +6264,13 @@ static void    mwMutexUnlock( void )
 
 static void    mwMutexInit( void )
 {
-    pthread_mutex_init( &mwGlobalMutex, NULL );
+    pthread_mutexattr_t attr;
+
+    /* mwRealloc() and mwStrdup() call mwMalloc() with the lock held */
+    pthread_mutexattr_init( &attr );
+    pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE );
+    pthread_mutex_init( &mwGlobalMutex, &attr );
+    pthread_mutexattr_destroy( &attr );
     return;
 }
 
@@ -250,6 +250,11 @@
 **      your code under simulated low memory conditions.
 **      Detect: At new, malloc(), realloc() or calloc().
 **      Action: NULL is returned.
+**  Quota fail:
+**      A request to allocate memory failed since it would pass the
+**      hard limit of a quota set using mwQuota().
+**      Detect: At new, malloc(), realloc() or calloc().
+**      Action: NULL is returned.
 **  Assert trap:
 **      An ASSERT() failed. The ASSERT() macro works like C's assert()
 **      macro/function, except that it's interactive. See your C manual.
@@ -360,6 +365,15 @@ extern "C" {
 #define MW_TEST_ALLOC   0x0002  /* test allocations & NML guards */
 #define MW_TEST_NML     0x0004  /* test all-NML areas for modifications */
 
+#define MW_MEM_USER     0       /* bytes in blocks the program has */
+#define MW_MEM_OVERHEAD 1       /* memwatch's headers, guards and no-mans-land */
+#define MW_MEM_SLACK    2       /* the C library's rounding and chunk headers */
+#define MW_MEM_UNTRACKED 3      /* allocated by others, such as memwatch itself */
+#define MW_MEM_FREE     4       /* free memory kept by the C library */
+#define MW_MEM_OTHER    5       /* resident, but not in the C library's heap */
+#define MW_MEM_RSS      6       /* resident set size of the process */
+#define MW_MEM_COUNT    7
+
 #define MW_NML_NONE     0       /* no NML */
 #define MW_NML_FREE     1       /* turn FREE'd memory into NML */
 #define MW_NML_ALL      2       /* all unused memory is NML */
@@ -370,6 +384,17 @@ extern "C" {
 #define MW_STAT_LINE    2       /* collect statistics on a line basis */
 #define MW_STAT_DEFAULT 0       /* the default statistics setting */
 
+#define MW_LOG_SYNC     0       /* write each message as it's logged */
+#define MW_LOG_DEFER    1       /* write messages on mwFlushNow() or when full */
+#define MW_LOG_THREAD   2       /* a writer thread writes messages (pthreads) */
+
+#define MW_LOG_BLOCK    0       /* full log: wait until there is room */
+#define MW_LOG_DROP     1       /* full log: drop the message, count it lost */
+
+#define MW_STACK_NONE   0       /* no call stacks */
+#define MW_STACK_ALLOC  1       /* capture the stack of each allocation */
+#define MW_STACK_FREE   2       /* and of each free */
+
 /*
 ** MemWatch internal constants
 **  You may change these and recompile MemWatch to change the limits
@@ -377,6 +402,49 @@ extern "C" {
 */
 #define MW_TRACE_BUFFER 2048    /* (min 160) size of TRACE()'s output buffer */
 #define MW_FREE_LIST    64      /* (min 4) number of free()'s to track */
+#define MW_MARK_HASH    1024    /* (power of 2) buckets in the mwMark() hash */
+#define MW_LOG_SLOT     256     /* (min 160) bytes per log message slot */
+#define MW_LOG_SLOTS    256     /* (min 16) number of log message slots */
+#define MW_SITE_HASH    4096    /* (power of 2) buckets in the site hash */
+#define MW_REC_CHUNK    65536   /* (min 256) bytes of events per trace chunk */
+#define MW_FLIGHT_RINGS 16      /* (min 1) threads with a flight recorder ring */
+#define MW_FLIGHT_SITES 4096    /* (min 1) sites in the flight recorder */
+#define MW_FLIGHT_POOL  65536   /* (min 0) bytes of file names in the flight recorder */
+#define MW_HIST_BITS    2       /* (min 0) log2 of size classes per power of two */
+#define MW_HIST_CLASSES 128     /* (min 16) size classes, the last holds the rest */
+#define MW_LIFE_SHORT   1000L   /* (min 1) median age in operations of short-lived blocks */
+#define MW_LIFE_LONG    1000000L /* (min MW_LIFE_SHORT) and of long-lived blocks */
+#define MW_CHURN_MIN    1000L   /* (min 1) frees before a site can be a pooling candidate */
+#define MW_CHURN_SIZE   1024    /* (min 1) largest block size of a pooling candidate */
+#define MW_CHURN_TOP    10      /* (min 1) pooling candidates listed */
+#define MW_PEAK_SITES   32      /* (min 1) sites kept in the peak usage breakdown */
+#define MW_PEAK_STEP    16      /* (min 1) peaks less than 1/this above the last are skipped */
+#define MW_TIMELINE_SAMPLES 256 /* (min 4, even) samples kept in the timeline */
+#define MW_TIMELINE_TOP 5       /* (min 1) largest sites kept per sample */
+#define MW_TIMELINE_WIDTH 64    /* (min 8) columns in the timeline chart */
+#define MW_TIMELINE_HEIGHT 16   /* (min 2) rows in the timeline chart */
+#define MW_TIMELINE_PROC 8      /* (min 1) samples per reading of heap and RSS */
+#define MW_LEAK_WINDOWS 8       /* (min 3) windows of history kept per site */
+#define MW_LEAK_OLD     4       /* (min 1, < MW_LEAK_WINDOWS) windows before a block is old */
+#define MW_LEAK_SCORE   50      /* (min 1) lowest score that makes a leak suspect */
+#define MW_LEAK_TOP     10      /* (min 1) leak suspects kept */
+#define MW_THREADS      32      /* (min 2) threads counted apart; the rest share #0 */
+#define MW_THREAD_LIST  10      /* (min 1) blocks listed when a thread exits */
+#define MW_TAGS         64      /* (min 1, max 255) distinct tags */
+#define MW_TAG_DEPTH    16      /* (min 1) tags a thread can have pushed */
+#define MW_QUOTAS       16      /* (min 1, max 31) quotas that can be set */
+#define MW_SCOPE_LIST   10      /* (min 1) survivors listed when a scope ends */
+#define MW_UNFREED_TOP  20      /* (min 1) sites listed by a fast exit */
+#define MW_UNFREED_SAMPLES 3    /* (min 1) addresses shown per unfreed site */
+#define MW_STACK_DEPTH  16      /* (min 1) frames kept per call stack */
+#define MW_STACK_HASH   4096    /* (power of 2) buckets in the stack depot */
+#define MW_STACK_TOP    10      /* (min 1) stacks listed in reports */
+#define MW_STACK_SPAN   65536   /* (min 256) largest frame MW_STACK_FP walks over */
+#ifndef MW_FLIGHT_STATIC
+#define MW_FLIGHT_STATIC 0      /* (0, or room for 16 events a ring) bytes of in-memory flight recorder */
+#endif
+#define MW_MAPS_MAX     2048    /* (min 64) memory map ranges cached before the table grows (Linux) */
+#define MW_MAPS_UNMAP   65536L  /* rescan memory map after free()ing this much */
 
 /*
 ** Exported variables
@@ -436,6 +504,141 @@ void  mwAbort( void );
 **      is used. Slows down performance, of course.
 **  - mwCalcCheck() calculates checksums for all data buffers. Slow!
 **  - mwDumpCheck() logs buffers where stored & calc'd checksums differ. Slow!!
+**  - mwOutOfLine() keeps a copy of every block's size, origin, counter
+**      and flags in contiguous arrays, outside the blocks themselves.
+**      CHECK() then sweeps these arrays and reads only the guard bytes
+**      of each block, and a block header that's been overwritten by an
+**      underflow is restored from the copy. Costs some memory per block.
+**  - mwRecordOpen() starts writing a binary trace of all allocation,
+**      free, realloc, mark and check events to a file (or a named pipe),
+**      for offline analysis. The format is described in mwtrace.h.
+**      Returns nonzero if the file was opened.
+**  - mwRecordClose() ends the trace. mwAbort() calls this too.
+**  - mwRecordFilter() limits the trace to allocations made in a file
+**      (and line, if nonzero) and with a size in [minsize,maxsize].
+**      A NULL file and zero sizes remove the filter.
+**  - mwFlightOpen() keeps the last 'events' allocations, frees and
+**      checks of each thread in a file mapped into memory, so they can
+**      be read with memwatch-flight after the program has crashed.
+**      With a NULL path, or where files can't be mapped, a static
+**      array of MW_FLIGHT_STATIC bytes is used instead, which can be
+**      read from a core dump. There is none unless memwatch.c is
+**      compiled with MW_FLIGHT_STATIC set, e.g. to 262144; it must
+**      hold the site table, the file name pool and 16 events for each
+**      of the MW_FLIGHT_RINGS rings, or it is not used.
+**      Returns nonzero if recording started.
+**  - mwFlightClose() stops the flight recorder, leaving the file as
+**      it is. mwAbort() calls this too.
+**  - mwStacks() turns call stack capture on or off; see MW_STACK_xxx.
+**      Each distinct stack is stored once and numbered. Unfreed blocks
+**      show their stack number, and mwAbort() lists unfreed memory and
+**      allocations by stack, with symbol names where the system has
+**      backtrace_symbols(). Stacks come from backtrace() where there is
+**      one. Define MW_STACK_FP to walk frame pointers instead, which is
+**      faster but needs all code compiled with -fno-omit-frame-pointer.
+**  - mwLifetimes() turns block lifetime tracking on or off. Each block
+**      then records the time it was allocated, and mwAbort() lists, per
+**      site, the median age of the freed blocks in operations and in
+**      time. Sites are classed as short-lived (candidates for an arena
+**      or the stack), medium or long-lived; see MW_LIFE_SHORT/LONG.
+**  - mwChurn() turns churn tracking on or off. mwAbort() then lists the
+**      sites that allocate and free many small blocks of one size,
+**      with their allocation rate and live blocks, ranked by the
+**      malloc() and free() calls a pool would save. The bytes saved
+**      are an estimate of the C library's per-block overhead.
+**  - mwPeaks() turns peak tracking on or off. Each time the heap sets a
+**      new high, the live bytes of each site are summed, and mwAbort()
+**      lists the MW_PEAK_SITES largest. A new peak is only taken if it
+**      is 1/MW_PEAK_STEP above the last, so steady growth stays cheap.
+**  - mwPeakSite() returns the live bytes of the n'th largest site at
+**      the peak, and its file, line and block count; or -1 if none.
+**  - mwTimeline() samples heap usage every 'ops' operations or every
+**      'ms' milliseconds, whichever is non-zero (or first); zero for
+**      both stops. Each sample has the bytes and blocks in use, bytes
+**      in no-mans-land, and the MW_TIMELINE_TOP largest sites. When
+**      MW_TIMELINE_SAMPLES have been taken, pairs are merged and the
+**      interval doubles. mwAbort() draws a chart of the timeline.
+**  - mwTimelineWrite() writes the timeline to a file, as CSV or, if
+**      'chart' is nonzero, as a chart. Returns nonzero on success.
+**      Heap and RSS are only read every MW_TIMELINE_PROC samples; the
+**      CSV leaves them empty in the samples between.
+**  - mwLeakWatch() looks for leaks while the program runs, for programs
+**      that never get to mwAbort(). Every 'ms' milliseconds, each
+**      site's live blocks are counted by age. A site is scored 0-100,
+**      half for how often its block count has grown (it must never
+**      have dropped) over the last MW_LEAK_WINDOWS windows, and half
+**      for its share of blocks older than MW_LEAK_OLD windows. If
+**      'log' is nonzero, the suspects are logged after each window.
+**      Only blocks allocated while watching are counted. Zero stops.
+**  - mwLeakSuspect() returns the score of the n'th leak suspect, and its
+**      file, line and live blocks; or -1 if none.
+**  - mwThreads() turns per-thread accounting on or off. Each thread's
+**      allocations, frees and live bytes are counted, as are blocks
+**      freed by another thread than the one that allocated them, for
+**      each pair of threads. mwAbort() lists both. With pthreads,
+**      a thread that exits still owning blocks has them listed.
+**      Threads are numbered from 1 in the order they first call
+**      memwatch.
+**  - mwThreadOwner() returns the number of the thread that allocated
+**      a block, or zero if it's not a memwatch block.
+**  - mwThreadExit() lists the blocks the calling thread allocated that
+**      are still live. For threads that pthreads can't tell us about.
+**  - mwPushTag() charges the calling thread's allocations to a tag, such
+**      as "parser" or "cache", until the matching mwPopTag(). Tags
+**      nest; the innermost one is charged. A NULL name pushes no tag.
+**      A block keeps its tag when realloc()'ed. The current, peak
+**      and total bytes of each tag are kept without the lock, and
+**      mwAbort() lists them. At most MW_TAGS names can be used.
+**  - mwTagInfo() gives the name and current, peak and total bytes of the
+**      n'th tag (from 0). Returns zero if there is no such tag.
+**  - mwQuota() sets a budget for part of the program. 'match' is either
+**      "tag:name", for the blocks of a tag, or part of a file name,
+**      for the blocks allocated in files whose names contain it. A
+**      tagged block is only charged to its tag's quota. Past the
+**      'soft' limit, 'func' is called once with the bytes in use,
+**      outside memwatch's lock so it can free memory, and again only
+**      after usage has dropped below the limit. Allocations that
+**      would pass the 'hard' limit fail. Zero means no limit. A
+**      realloc() is charged the change in size. Setting the same
+**      'match' again changes its limits. Returns the quota number,
+**      or zero if MW_QUOTAS are already set. Blocks allocated
+**      before the quota was set are not charged to it.
+**  - mwQuotaUsed() returns the bytes in use in quota number 'n', and
+**      the peak through 'peak'; or -1 if there is no such quota.
+**  - mwScopeBegin() starts a scope, such as the handling of one request,
+**      for the calling thread, and returns its number. Scopes nest.
+**      Blocks allocated in the innermost open scope are kept on its
+**      list until freed, even by another thread, and keep their
+**      scope through realloc().
+**  - mwScopeEnd() ends the thread's innermost scope. Blocks allocated in
+**      it that are still live are listed at once, in time proportional
+**      to their number, and then forgotten by the scope. Returns how
+**      many there were. Use SCOPE_BEGIN() and SCOPE_END().
+**  - mwMemUsage() breaks down the process' resident memory into the
+**      MW_MEM_COUNT values of 'usage'; see MW_MEM_USER and on. On
+**      Linux with glibc it uses /proc/self/smaps_rollup, mallinfo2()
+**      and malloc_usable_size(); elsewhere only the first three are
+**      known. Returns zero if the resident size couldn't be found.
+**      It visits every block. mwAbort() shows the breakdown, and
+**      the timeline samples the heap and resident sizes too.
+**  - mwUnfreed() changes how unfreed blocks are reported by mwAbort().
+**      If 'top' is nonzero, they are summed by site instead of listed
+**      one by one, and the 'top' sites with the most bytes are shown
+**      with a few addresses and the first bytes of one block. If
+**      'fast' is nonzero, the heap is not released or checked for
+**      no-mans-land writes, so even a huge heap is quick to exit
+**      from; blocks are summed by site, MW_UNFREED_TOP sites if 'top'
+**      is zero.
+**  - mwOwned() returns nonzero if 'p' was allocated by memwatch, whether
+**      it's still live or in no-mans-land, and gives its size. It
+**      only looks at the block's header and doesn't log anything,
+**      so it can be used on pointers from other allocators. Compiled
+**      with MW_PTRHASH, memwatch keeps every block in a hash, and
+**      mwOwned() looks it up there instead, which is exact.
+**  - mwStackId() returns the number of a block's allocation stack, or
+**      zero if it has none.
+**  - mwStackFrames() copies up to 'max' return addresses of a stack to
+**      'pc', innermost first, and returns the number copied.
 **  - mwMark() sets a generic marker. Returns the pointer given.
 **  - mwUnmark() removes a generic marker. If, at the end of execution, some
 **      markers are still in existence, these will be reported as leakage.
@@ -452,9 +655,70 @@ void        mwFreeBufferInfo( int onoff );
 void        mwAutoCheck( int onoff );
 void        mwCalcCheck( void );
 void        mwDumpCheck( void );
+void        mwOutOfLine( int onoff );
+int         mwRecordOpen( const char *path );
+void        mwRecordClose( void );
+void        mwRecordFilter( const char *file, int line, size_t minsize, size_t maxsize );
+int         mwFlightOpen( const char *path, long events );
+void        mwFlightClose( void );
+void        mwStacks( int level );
+void        mwLifetimes( int onoff );
+void        mwChurn( int onoff );
+void        mwPeaks( int onoff );
+void        mwTimeline( long ops, long ms );
+int         mwTimelineWrite( const char *path, int chart );
+void        mwLeakWatch( long ms, int log );
+void        mwThreads( int onoff );
+void        mwPushTag( const char *name );
+void        mwPopTag( void );
+int         mwTagInfo( int n, const char **name, long *cur, long *peak, long *total );
+int         mwQuota( const char *match, long soft, long hard, void (*func)( const char *match, long bytes ) );
+long        mwQuotaUsed( int n, long *peak );
+unsigned    mwScopeBegin( const char *file, int line );
+int         mwMemUsage( long *usage );
+void        mwUnfreed( int top, int fast );
+int         mwOwned( void *p, size_t *size );
+long        mwScopeEnd( const char *file, int line );
+unsigned    mwThreadOwner( void *p );
+void        mwThreadExit( void );
+int         mwLeakSuspect( int n, const char **file, int *line, long *blocks );
+long        mwPeakSite( int n, const char **file, int *line, long *blocks );
+unsigned    mwStackId( void *p );
+int         mwStackFrames( unsigned id, void **pc, int max );
 void *      mwMark( void *p, const char *description, const char *file, unsigned line );
 void *      mwUnmark( void *p, const char *file, unsigned line );
 
+/*
+** Size histograms
+**  Allocation sizes are counted in log-linear size classes, globally
+**  and, with mwStatistics() on, per module and line. mwStatReport()
+**  (called from mwAbort()) lists them.
+**  - mwSizeHistogram() copies MW_HIST_CLASSES counts to 'counts'; of
+**      all allocations, or if 'live' is nonzero, of the blocks still
+**      allocated. 'file' NULL gives the global counts, and 'line' -1
+**      those of a whole module. Returns zero if there are no such
+**      statistics.
+**  - mwSizeClassMin() returns the smallest size in a size class.
+*/
+int     mwSizeHistogram( const char *file, int line, int live, long *counts );
+size_t  mwSizeClassMin( int cls );
+
+/*
+** Heap snapshots
+**  - mwSnapshot() returns a summary of the live blocks of each site,
+**      with the lowest and highest mwCounter among them, or NULL if
+**      out of memory. The lock is held only while the block data is
+**      copied, so snapshots can be taken in a running program.
+**  - mwSnapshotDiff() writes the sites whose live bytes or blocks grew
+**      from snapshot 'a' to 'b' to the log, most growth first, and
+**      returns how many there were.
+**  - mwSnapshotFree() frees a snapshot.
+*/
+typedef struct mwSnap_ mwSnap;
+mwSnap* mwSnapshot( void );
+int     mwSnapshotDiff( const mwSnap *a, const mwSnap *b );
+void    mwSnapshotFree( mwSnap *snap );
+
 /*
 ** Testing/verification/tracing
 **  All of these macros except VERIFY() evaluates to a null statement
@@ -463,7 +727,9 @@ void *      mwUnmark( void *p, const char *file, unsigned line );
 **  - mwIsSafeAddr() checks a memory area for both read & write privilige.
 **      This function and mwIsReadAddr() is highly system-specific and
 **      may not be implemented. If this is the case, they will default
-**      to returning nonzero for any non-NULL pointer.
+**      to returning nonzero for any non-NULL pointer. On Linux, they
+**      look the area up in a cached copy of /proc/self/maps, and never
+**      touch the memory itself. Define MW_NOMAPS to use SIGSEGV probing.
 **  - CHECK() does a complete memory integrity test. Slow!
 **  - CHECK_THIS() checks only selected components.
 **  - CHECK_BUFFER() checks the indicated buffer for errors.
@@ -492,6 +758,19 @@ int   mwVerify( int, const char*, const char*, int );
 **  - mwSetOutFunc() allows you to give the adress of a function
 **      where all user output will go. (exeption: see mwSetAriFunc)
 **      Specifying NULL will direct output to the log file.
+**  - mwSetOutSink() is like mwSetOutFunc(), but the function is
+**      given a whole message (not NUL terminated) and its length.
+**  - mwSetOutFd() writes output to a file descriptor. The default is 2.
+**  - mwLogMode() sets when output is written. Output is queued in a
+**      lock-free ring buffer (MW_LOG_SLOTS messages), so logging never
+**      waits for I/O while memwatch holds its lock. MW_LOG_SYNC writes
+**      each message right away (the default), MW_LOG_DEFER waits for
+**      mwFlushNow(), a full buffer or program end, and MW_LOG_THREAD
+**      lets a writer thread do it. See the MW_LOG_xxx defines.
+**  - mwLogPolicy() sets what to do when the buffer is full;
+**      MW_LOG_BLOCK (the default) or MW_LOG_DROP.
+**  - mwLogLost() returns the number of messages dropped so far.
+**  - mwLogColor() turns the ANSI color codes around messages on or off.
 **  - mwSetAriFunc() gives MEMWATCH the adress of a function to call
 **      when an 'Abort, Retry, Ignore' question is called for. The
 **      actual error message is NOT printed when you've set this adress,
@@ -510,6 +789,12 @@ int   mwVerify( int, const char*, const char*, int );
 void  mwTrace( const char* format_string, ... );
 void  mwPuts( const char* text );
 void  mwSetOutFunc( void (*func)(int) );
+void  mwSetOutSink( void (*func)(const char*,unsigned) );
+void  mwSetOutFd( int fd );
+void  mwLogMode( int mw_log_mode );
+void  mwLogPolicy( int mw_log_policy );
+unsigned long mwLogLost( void );
+void  mwLogColor( int onoff );
 void  mwSetAriFunc( int (*func)(const char*) );
 void  mwSetAriAction( int mw_ari_value );
 int   mwAriHandler( const char* cause );
@@ -585,6 +870,8 @@ char* mwStrdup( const char *, const char*, int );
 #define CHECK_BUFFER(b) mwTestBuffer(__FILE__,__LINE__,b)
 #define MARK(p)         mwMark(p,#p,__FILE__,__LINE__)
 #define UNMARK(p)       mwUnmark(p,__FILE__,__LINE__)
+#define SCOPE_BEGIN()   mwScopeBegin(__FILE__,__LINE__)
+#define SCOPE_END()     mwScopeEnd(__FILE__,__LINE__)
 
 #else /* MEMWATCH */
 
@@ -620,10 +907,52 @@ extern void mwDummyTraceFunction(const char *,...);
 #define mwLimit(n)
 #define mwTest(f,l)
 #define mwSetOutFunc(f)
+#define mwSetOutSink(f)
+#define mwSetOutFd(n)
+#define mwLogMode(n)
+#define mwLogPolicy(n)
+#define mwLogLost()         (0)
+#define mwLogColor(n)
+#define mwFlushNow()
 #define mwSetAriFunc(f)
 #define mwDefaultAri()
 #define mwNomansland()
 #define mwStatistics(f)
+#define mwOutOfLine(n)
+#define mwRecordOpen(p)     (0)
+#define mwRecordClose()
+#define mwRecordFilter(f,l,a,b)
+#define mwFlightOpen(p,n)   (0)
+#define mwFlightClose()
+#define mwStacks(n)
+#define mwLifetimes(n)
+#define mwChurn(n)
+#define mwPeaks(n)
+#define mwTimeline(o,t)
+#define mwTimelineWrite(p,c) (0)
+#define mwLeakWatch(t,l)
+#define mwThreads(n)
+#define mwPushTag(n)
+#define mwPopTag()
+#define mwTagInfo(n,a,c,p,t) (0)
+#define mwQuota(m,s,h,f) (0)
+#define mwQuotaUsed(n,p) (-1L)
+#define mwScopeBegin(f,l)   (0)
+#define mwScopeEnd(f,l)     (0L)
+#define mwMemUsage(u)       (0)
+#define mwUnfreed(t,f)
+#define mwOwned(p,s)        (0)
+#define mwThreadOwner(p) (0)
+#define mwThreadExit()
+#define mwLeakSuspect(n,f,l,b) (-1)
+#define mwPeakSite(n,f,l,b) (-1L)
+#define mwSizeHistogram(f,l,v,c) (0)
+#define mwSizeClassMin(c)   ((size_t)0)
+#define mwSnapshot()        ((mwSnap*)0)
+#define mwSnapshotDiff(a,b) (0)
+#define mwSnapshotFree(s)
+#define mwStackId(p)        (0)
+#define mwStackFrames(i,p,n) (0)
 #define mwMark(p,t,f,n)     (p)
 #define mwUnmark(p,f,n)     (p)
 #define mwMalloc(n,f,l)     malloc(n)
@@ -644,6 +973,8 @@ extern void mwDummyTraceFunction(const char *,...);
 #define CHECK_BUFFER(b)
 #define MARK(p)             (p)
 #define UNMARK(p)           (p)
+#define SCOPE_BEGIN()       (0)
+#define SCOPE_END()         (0L)
 /*lint -restore */
 
 #endif /* MEMWATCH */
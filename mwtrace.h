@@ -0,0 +1,175 @@
+/*
+** MWTRACE.H
+** Binary allocation event trace format written by mwRecordOpen()
+**
+** This file is part of MEMWATCH.
+** MEMWATCH is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version. See gpl.txt for details.
+**
+************************************************************************
+**
+** A trace file starts with the 8 bytes MWT_MAGIC, followed by records.
+** Every record starts with a one byte tag:
+**
+**  MWT_SITE    varint id, varint line, varint length, 'length' bytes
+**              of file name. A site is written once per file, before
+**              any chunk that refers to it. A zero length means the
+**              file name is unknown.
+**  MWT_CHUNK   varint thread, varint length, 'length' bytes of events.
+**              Each thread fills its own chunks, so the events of one
+**              chunk are in mwCounter order, but chunks of different
+**              threads may not be.
+**  MWT_END     varint counter, varint time. Written by mwRecordClose().
+**
+** An event is a one byte type and these fields:
+**
+**  varint      counter, minus the counter of the previous event
+**  varint      time in nanoseconds, minus the previous event's time
+**  varint      site id
+**  varint      size
+**  zigzag      address, minus the previous event's address
+**
+** Deltas start from zero at the beginning of each chunk, so a chunk can
+** be decoded without looking at any other chunk. Some event types carry
+** more fields after these:
+**
+**  MWT_ALLOC   allocation; site is where it was made
+**  MWT_FREE    free; site and size are those of the allocation,
+**              followed by varint age (mwCounter at free minus
+**              mwCounter at allocation)
+**  MWT_REALLOC realloc() that moved a block; site is where realloc()
+**              was called, size and address are the new ones, followed
+**              by zigzag old address minus new address and varint old
+**              size. The MWT_ALLOC and MWT_FREE events for the same
+**              move are recorded too, so totals add up without it.
+**  MWT_MARK    mwMark(); size is zero
+**  MWT_UNMARK  mwUnmark(); size is zero
+**  MWT_CHECK   CHECK(); size is the number of errors found, address 0
+**
+** A varint is 7 bits per byte, least significant first, with the top
+** bit set on all but the last byte. A zigzag value maps signed to
+** unsigned as (v << 1) ^ (v >> 63) before varint encoding.
+*/
+
+#ifndef __MWTRACE_H
+#define __MWTRACE_H
+
+#define MWT_MAGIC       "MWTRACE1"
+
+#define MWT_SITE        'S'
+#define MWT_CHUNK       'C'
+#define MWT_END         'E'
+
+#define MWT_ALLOC       1
+#define MWT_FREE        2
+#define MWT_REALLOC     3
+#define MWT_MARK        4
+#define MWT_UNMARK      5
+#define MWT_CHECK       6
+
+/*
+** Flight recorder, written by mwFlightOpen()
+**
+** The recorder is a single block of memory, either a file mapped with
+** MAP_SHARED or a static array that ends up in a core dump. It starts
+** with an mwfHeader, followed by 'sites' mwfSite entries, 'pool' bytes
+** of NUL terminated file names and 'rings' rings. A ring is an mwfRing
+** followed by 'events' mwfEvent slots. The event with number n (from
+** zero) is in slot n % events, and 'head' is the number of events
+** written to the ring so far. Event types are the MWT_ types above;
+** 'aux' is the age for MWT_FREE, the old address for MWT_REALLOC and
+** unused otherwise. Site 0 is unknown; other sites have 'name' set to
+** the file name's offset in the pool plus one.
+**
+** Everything is stored in the byte order and alignment of the program
+** that wrote it; all offsets are relative to the header.
+*/
+
+#define MWF_MAGIC       "MWFLITE1"
+
+#ifndef MWT_U32
+#define MWT_U32         unsigned int
+#endif
+#ifndef MWT_U64
+#if defined(ULLONG_MAX) || defined(ULONG_LONG_MAX)
+#define MWT_U64         unsigned long long
+#else
+#define MWT_U64         unsigned long
+#endif
+#endif
+
+typedef struct {
+    char        magic[8];   /* MWF_MAGIC */
+    MWT_U32     size;       /* bytes in the whole recorder */
+    MWT_U32     rings;      /* number of rings */
+    MWT_U32     events;     /* slots per ring */
+    MWT_U32     sites;      /* entries in the site table */
+    MWT_U32     pool;       /* bytes of file names */
+    MWT_U32     ringsused;  /* rings taken by threads so far */
+    MWT_U32     poolused;   /* file name bytes used so far */
+    MWT_U32     errors;     /* mwErrors as of the latest event */
+    MWT_U64     counter;    /* mwCounter as of the latest event */
+    } mwfHeader;
+
+typedef struct {
+    MWT_U32     line;
+    MWT_U32     name;
+    } mwfSite;
+
+typedef struct {
+    MWT_U32     thread;     /* thread number, as in the event trace */
+    MWT_U32     reserved;
+    MWT_U64     head;
+    } mwfRing;
+
+typedef struct {
+    MWT_U64     counter;
+    MWT_U64     addr;
+    MWT_U64     size;
+    MWT_U64     aux;
+    MWT_U32     site;
+    MWT_U32     type;
+    } mwfEvent;
+
+/* bytes taken by the header, site table and pool, rounded up to 8 */
+#define MWF_RINGS(sites,pool) \
+    ((sizeof(mwfHeader)+(sites)*sizeof(mwfSite)+(pool)+7)&~(size_t)7)
+#define MWF_RINGSIZE(events) (sizeof(mwfRing)+(events)*sizeof(mwfEvent))
+
+#if !defined(__MEMWATCH_C) && !defined(MWT_NODECODE)
+
+/*
+** Decoding helpers for trace readers. They return the position
+** after the value, or NULL if the value runs past 'end'.
+** Define MWT_NODECODE to leave them out.
+*/
+
+static const unsigned char *mwtGetVar( const unsigned char *p,
+    const unsigned char *end, unsigned long long *v )
+{
+    unsigned long long r = 0;
+    int shift = 0;
+    while( p < end && shift < 64 ) {
+        r |= (unsigned long long)( *p & 0x7F ) << shift;
+        if( !( *p++ & 0x80 ) ) { *v = r; return p; }
+        shift += 7;
+        }
+    return NULL;
+}
+
+static const unsigned char *mwtGetZig( const unsigned char *p,
+    const unsigned char *end, long long *v )
+{
+    unsigned long long u;
+    p = mwtGetVar( p, end, &u );
+    if( p != NULL ) *v = (long long)( u >> 1 ) ^ -(long long)( u & 1 );
+    return p;
+}
+
+#endif /* !__MEMWATCH_C && !MWT_NODECODE */
+
+#endif /* __MWTRACE_H */
+
+/* EOF MWTRACE.H */